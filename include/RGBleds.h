@@ -5,9 +5,49 @@
 #include <OctoWS2811.h>     // High performance WS2811/WS2812 library for Teensy3.X
 
 #include "makeColor.h"
+#include "palette.h"
+
+#define RGB_LEDS_PER_STRIP  20      // longest strip on any of the 8 outputs
+#define RGB_TICK_HZ         100     // rgbUpdate() is called from the 10ms main loop
+#define RGB_MAX_STRIPS      8       // OctoWS2811 outputs driven by one DMA transfer
+#define RGB_FRAME_BUDGET_US 1000    // effect render time allowed per tick
+
+/* Draws one frame of a strip; frame counts the updates of that strip */
+typedef void (*rgb_effect)(uint8_t output, uint8_t length, unsigned long frame);
 
 void rgbSetup();
 
+/* Renders due strips within the time budget and shows the frame if it changed */
 void rgbUpdate();
 
-#endif // RGBLEDS_H
\ No newline at end of file
+/* Assigns an effect to an OctoWS2811 output (0-7), returns false if invalid */
+bool rgbAddStrip(uint8_t output, uint8_t length, rgb_effect effect, uint8_t fps);
+
+/* Sets a pixel for the next frame, marks it dirty only if the color changed */
+void rgbSetPixel(uint16_t index, int rgb);
+void rgbSetStripPixel(uint8_t output, uint8_t index, int rgb);
+
+/* Upper limit for the show() rate, rounded to a whole number of 10ms ticks */
+void rgbSetFrameRate(uint8_t fps);
+
+/* Output stage applied when pixels are packed: gamma 2.2, global brightness
+ * and per-channel balance (255 = full). Temporal dithering spreads the lost
+ * fractional bits over frames for smooth low-brightness fades, but makes
+ * every frame differ while enabled. */
+void rgbSetBrightness(uint8_t level);
+void rgbSetColorBalance(uint8_t red, uint8_t green, uint8_t blue);
+void rgbSetDithering(bool enable);
+
+/* Scales each channel of a color by level/256 */
+int rgbScale(int rgb, uint8_t level);
+
+/* Moving rainbow test pattern */
+void rgbRainbowEffect(uint8_t output, uint8_t length, unsigned long frame);
+
+/* Frame statistics: transfers started, frames skipped as unchanged and
+ * strips pushed to the next tick by the render budget */
+unsigned long rgbFramesShown();
+unsigned long rgbFramesSkipped();
+unsigned long rgbStripsDeferred();
+
+#endif // RGBLEDS_H
@@ -0,0 +1,45 @@
+#ifndef BATTERYHEALTH_H
+#define BATTERYHEALTH_H
+
+#include <Arduino.h>
+#include "bq769x0CRC.h"
+
+/*
+ * Capacity, cycle count and state of health learning
+ *
+ * Coulomb counts the pack current after every BMS.update(). A discharge from
+ * a full pack (max cell at fullCell_mV and charge current tapered off) down to
+ * an empty one (min cell at emptyCell_mV) is one capacity measurement, which
+ * is blended into the learned capacity. Discharged charge is counted as
+ * equivalent full cycles.
+ *
+ * The result survives resets in EEPROM: CRC-8 protected records, rotated over
+ * EEPROM_HEALTH_SLOTS slots and only written when something changed by a
+ * meaningful amount.
+ */
+
+#define HEALTH_RECORD_VERSION   1
+#define HEALTH_FULL_TAPER_MA    200     // charge current at which a full cell counts as full
+#define HEALTH_MIN_CHANGE_MAH   10      // capacity change worth an EEPROM write
+#define HEALTH_SAVE_THROUGHPUT_MAH 250  // discharge between writes, bounds loss on reset
+
+typedef struct {
+  uint16_t  sequence;         // incremented per write, the newest record wins
+  uint16_t  capacity_mAh;     // learned full capacity
+  uint16_t  cycles;           // equivalent full cycles
+  uint16_t  throughput_mAh;   // discharged since the last counted cycle
+  uint8_t   version;          // HEALTH_RECORD_VERSION
+  uint8_t   crc;              // CRC-8 (SMBus) of the bytes above
+} __attribute__((packed)) health_record;
+
+/* Restores the newest valid record, or starts from the design capacity */
+void healthSetup(uint16_t designCapacity_mAh, int emptyCell_mV, int fullCell_mV);
+
+/* Call after every BMS.update() */
+void healthUpdate(bq769x0 &bms);
+
+uint16_t healthCapacity();      // mAh
+uint16_t healthCycles();
+uint16_t healthSOH();           // state of health in 0.1 %
+
+#endif // BATTERYHEALTH_H
@@ -0,0 +1,29 @@
+#ifndef BATTERYLEDS_H
+#define BATTERYLEDS_H
+
+#include "RGBleds.h"
+#include "bq769x0CRC.h"
+
+/*
+ * Battery state visualization
+ *
+ * batteryLedsUpdate() takes a snapshot of the BMS state after BMS.update(),
+ * the effects below only read that snapshot so rendering never touches I2C.
+ * Register the effects on an output with rgbAddStrip().
+ */
+
+/* Cell voltages mapped to an empty and a full state of charge bar */
+void batteryLedsSetRange(int empty_mV, int full_mV);
+
+/* Copy the BMS state used by the effects, call after BMS.update() */
+void batteryLedsUpdate(bq769x0 &bms);
+
+/* State of charge bar, pulses the leading pixel while charging and
+ * blinks the whole strip red while the BMS reports an error */
+void batteryLevelEffect(uint8_t output, uint8_t length, unsigned long frame);
+
+/* One pixel per cell, green when balanced to red at 60 mV above the lowest
+ * cell, cells that are being balanced pulse */
+void cellHeatmapEffect(uint8_t output, uint8_t length, unsigned long frame);
+
+#endif // BATTERYLEDS_H
@@ -0,0 +1,30 @@
+#ifndef BMSCONFIG_H
+#define BMSCONFIG_H
+
+#include <Arduino.h>
+#include "bq769x0CRC.h"
+
+/*
+ * BMS protection configuration kept in EEPROM
+ *
+ * One versioned, CRC-8 protected record holding a bq769x0_config. If it is
+ * missing, corrupted or of another version, the compiled-in default is used,
+ * so a fresh board boots protected without a configuration step.
+ */
+
+#define CONFIG_RECORD_VERSION   1
+
+typedef struct __attribute__((packed)) {
+  uint8_t         version;
+  bq769x0_config  config;
+  uint8_t         crc;          // CRC-8 (SMBus) over the bytes above
+} config_record;
+
+extern const bq769x0_config configDefault;
+
+// stored configuration, or configDefault if there is no valid one
+bq769x0_config configLoad();
+
+void configSave(const bq769x0_config &config);
+
+#endif // BMSCONFIG_H
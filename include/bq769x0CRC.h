@@ -29,11 +29,113 @@
 #define MAX_NUMBER_OF_CELLS 15
 #define MAX_NUMBER_OF_THERMISTORS 3
  
+// ICs that can be handled at the same time, each with its own ALERT slot
+#define BQ769X0_MAX_INSTANCES 4
+
 // IC type/size
 #define bq76920 1
 #define bq76930 2
 #define bq76940 3
 
+// SYS_STAT fault bits with their own recovery state
+#define NUM_FAULTS          6
+
+// coulomb counter conversion period in continuous mode (ms)
+#define CC_SAMPLE_PERIOD_MS 250
+
+// software charge overcurrent protection
+#define OCC_MAX_WINDOW      8         // samples, limits the delay to 2 s
+#define OCC_RECOVERY_MS     60000     // retry charging after a trip
+
+// internal resistance estimation
+#define IR_MIN_CURRENT_STEP_MA  500   // smaller steps are mostly noise
+#define IR_FORGETTING_SHIFT     5     // forgetting factor 1 - 1/32
+
+// temperature protection, temperatures in °C/10
+#define TEMP_SAMPLE_INTERVAL_MS 2000  // TS conversion period of the bq769x0
+#define TEMP_HYSTERESIS     30        // 3 °C
+#define DIE_TEMP_V25_UV     1200000   // TS reading of the die at 25 °C, without thermistors
+#define DIE_TEMP_SLOPE_UV   420       // per °C/10, falling with temperature
+
+// software protection flags, reported above the SYS_STAT bits
+#define STAT_SW_OCC         0x100     // charge overcurrent
+#define STAT_SW_UTC         0x200     // under temperature for charging
+#define STAT_SW_OTC         0x400     // over temperature for charging
+#define STAT_SW_UTD         0x800     // under temperature for discharging
+#define STAT_SW_OTD         0x1000    // over temperature for discharging
+
+// software faults that only block one direction
+#define STAT_SW_CHG_FLAGS   (STAT_SW_OCC | STAT_SW_UTC | STAT_SW_OTC)
+#define STAT_SW_DSG_FLAGS   (STAT_SW_UTD | STAT_SW_OTD)
+
+// SYS_CTRL2 FET bits
+#define FET_CHG             0x01
+#define FET_DSG             0x02
+
+// I2C link manager: CRC-checked transfers, retries and bus clock selection.
+// With several ICs on one bus give them the same clock range, or a fixed
+// clock (min == max), as each of them steps the shared bus clock.
+#define I2C_RETRIES         3         // attempts after the first one
+#define I2C_RETRY_DELAY_US  50        // doubled for every retry
+#define I2C_CLOCK_MIN       100000    // Hz
+#define I2C_CLOCK_MAX       400000    // Hz, highest rate supported by the bq769x0
+#define I2C_CLOCK_WINDOW    500       // transfers per decision to step the clock up
+#define I2C_CLOCK_MAX_ERRORS 2        // errors per window that step the clock down
+#define I2C_MAX_BLOCK       (2 * MAX_NUMBER_OF_CELLS)  // data bytes per read
+
+typedef struct {
+  unsigned long transfers;            // attempts, including retries
+  unsigned long crcErrors;
+  unsigned long busErrors;            // NACK, timeout or short read
+  unsigned long failures;             // transfers that failed after all retries
+  unsigned long clock;                // current bus clock (Hz)
+} i2c_link_stats;
+
+// Complete protection and balancing configuration, applied with applyConfig().
+// Packed, it is stored as is in EEPROM (see bmsConfig.h).
+// Currents are 16 bit mA, so no limit can be set above 65.5 A. The config
+// region of the EEPROM has no room for wider fields; a pack that needs more
+// takes a new CONFIG_RECORD_VERSION with the currents in coarser units.
+typedef struct __attribute__((packed)) {
+  uint8_t   shuntResistor_mOhm;
+  int8_t    minDischargeTemp_degC;
+  int8_t    maxDischargeTemp_degC;
+  int8_t    minChargeTemp_degC;
+  int8_t    maxChargeTemp_degC;
+  uint16_t  idleCurrent_mA;
+  uint16_t  shortCircuitCurrent_mA;
+  uint16_t  shortCircuitDelay_us;
+  uint16_t  overcurrentCharge_mA;       // 0 disables the software protection
+  uint16_t  overcurrentChargeDelay_ms;
+  uint16_t  overcurrentDischarge_mA;
+  uint16_t  overcurrentDischargeDelay_ms;
+  uint16_t  cellUndervoltage_mV;
+  uint8_t   cellUndervoltageDelay_s;
+  uint16_t  cellOvervoltage_mV;
+  uint8_t   cellOvervoltageDelay_s;
+  uint8_t   balancingIdleTime_min;
+  uint16_t  balancingMinCell_mV;
+  uint8_t   balancingMaxDifference_mV;
+} bq769x0_config;
+
+// applyConfig() results
+#define CONFIG_OK           0
+#define CONFIG_INVALID      1         // rejected, nothing changed
+#define CONFIG_VERIFY_FAIL  2         // registers did not read back as written
+
+// soft warning bands, below the protection limits: index for
+// setWarningBand(), flag (1 << index) in getWarningStatus()
+#define WARN_CELL_LOW           0     // min cell voltage (mV) at or below
+#define WARN_CELL_HIGH          1     // max cell voltage (mV) at or above
+#define WARN_CHARGE_CURRENT     2     // charge current (mA) at or above
+#define WARN_DISCHARGE_CURRENT  3     // discharge current (mA) at or above
+#define WARN_TEMP_LOW           4     // lowest thermistor (°C/10) at or below
+#define WARN_TEMP_HIGH          5     // highest thermistor (°C/10) at or above
+#define NUM_WARNINGS            6
+
+// alternate between balancing sets this often (ms)
+#define BALANCING_SWAP_INTERVAL_MS 10000
+
 // output information to serial console for debugging
 #define BQ769X0_DEBUG 0
 
@@ -46,17 +148,20 @@ class bq769x0 {
     int begin(i2c_t3 *theWire, byte alertPin, byte bootPin = -1);
     int checkStatus();  // returns 0 if everything is OK
 		void update(void);
+		void beginUpdate(void);   // update() split in two, see bq769x0Poller
+		void finishUpdate(void);
 		void shutdown(void);
 
     // charging control
 		bool enableCharging(void);
-		void disableCharging(void);
+		bool disableCharging(void);
 		bool enableDischarging(void);
-		void disableDischarging(void);
+		bool disableDischarging(void);
     
     // hardware settings
     void setShuntResistorValue(int res_mOhm);
     void setThermistorBetaValue(int beta_K);
+    void setThermistors(bool fitted);   // TS inputs read thermistors, else the die temperature
 
     // limit settings (for battery protection)
     void setTemperatureLimits(int minDischarge_degC, int maxDischarge_degC, int minCharge_degC, int maxCharge_degC);    // °C
@@ -70,6 +175,13 @@ class bq769x0 {
  		void setBalancingThresholds(int idleTime_min = 30, int absVoltage_mV = 3400, byte voltageDifference_mV = 20);
     void setIdleCurrentThreshold(int current_mA);
 
+    // all of the above at once, independent of order, protection registers
+    // written in one burst and verified
+    int applyConfig(const bq769x0_config &config);
+    static bool configValid(const bq769x0_config &config);
+    bq769x0_config getConfig(void);   // settings in effect, quantized by the IC
+    bool protectionVerified(void);    // last protection write read back correctly
+
     // automatic balancing when battery is within balancing thresholds
 		void enableAutoBalancing(void);
 		void disableAutoBalancing(void);
@@ -80,12 +192,27 @@ class bq769x0 {
 		int  getCellVoltage(byte idCell);    // from 1 to 15
 		int  getMinCellVoltage(void);
 		int  getMaxCellVoltage(void);
+		int  getNumberOfCells(void);
+		int  getErrorStatus(void);
+		unsigned int getBalancingStatus(void);
+		long getCellResistance(byte idCell);  // uOhm, from 0 to numberOfCells-1
+		int  getTemperatureStatus(void);
+
+    // soft warnings, evaluated in update()
+    bool setWarningBand(byte warning, int threshold, int hysteresis);   // 0 if rejected
+    bool disableWarning(byte warning);
+    byte getWarningStatus(void);
+    byte getWarningChanges(void);     // flags changed since the last call
 		float getTemperatureDegC(byte channel = 1);
     float getTemperatureDegF(byte channel = 1);
 		
     // interrupt handling (not to be called manually!)
 		void setAlertInterruptFlag(void);
 
+    i2c_t3 *getWire(void);
+    void setI2CClockRange(unsigned long min_Hz, unsigned long max_Hz);
+    i2c_link_stats getLinkStats(void);
+
 #if BQ769X0_DEBUG
 		void printRegisters(void);		
 #endif
@@ -99,6 +226,7 @@ class bq769x0 {
 
     byte shuntResistorValue_mOhm;
     int thermistorBetaValue = 3435;  // typical value for Semitec 103AT-5 thermistor
+    bool thermistorsFitted = false;  // SYS_CTRL1 TEMP_SEL
 
     // indicates if a new current reading or an error is available from BMS IC
 		bool alertInterruptFlag = true;   // init with true to check and clear errors at start-up   
@@ -107,9 +235,20 @@ class bq769x0 {
 		int cellVoltages[MAX_NUMBER_OF_CELLS];          // mV
     byte idCellMaxVoltage;
     byte idCellMinVoltage;
-		long batVoltage;                                // mV
-		long batCurrent;                                // mA
+		long batVoltage = 0;                        // mV
+		long batCurrent = 0;                        // mA
+    bool currentUpdated = false;                    // new CC sample since last update()
+
+    // Internal resistance estimator state
+    int64_t irSumII = 0;                            // weighted sum of dI^2, mA^2
+    int64_t irSumIV[MAX_NUMBER_OF_CELLS];           // weighted sums of dI*dV, mA*mV
+    int irPrevVoltages[MAX_NUMBER_OF_CELLS];        // mV
+    long irPrevCurrent = 0;                         // mA
+    unsigned long irPrevTimestamp = 0;
+    bool irPrevValid = false;
 		int temperatures[MAX_NUMBER_OF_THERMISTORS];    // °C/10
+    bool temperaturesValid = false;
+    unsigned long temperatureTimestamp = 0;
 
     // Current limits (mA)
     long maxChargeCurrent;
@@ -117,10 +256,10 @@ class bq769x0 {
     int idleCurrentThreshold = 30; // mA
     
     // Temperature limits (°C/10)
-    int minCellTempCharge;
-    int minCellTempDischarge;
-    int maxCellTempCharge;
-    int maxCellTempDischarge;
+    int minCellTempCharge = 0;
+    int minCellTempDischarge = -200;
+    int maxCellTempCharge = 450;
+    int maxCellTempDischarge = 450;
 
     // Cell voltage limits (mV)
     int maxCellVoltage;
@@ -132,29 +271,95 @@ class bq769x0 {
     int adcOffset;  // mV
     
     int errorStatus = 0;
+    int softwareErrorStatus = 0;          // STAT_SW_* flags
+
+    // Soft warning bands, low warnings are stored negated so all of them
+    // compare the same way
+    int warningThreshold[NUM_WARNINGS];
+    int warningHysteresis[NUM_WARNINGS];
+    byte warningEnabled = 0;
+    byte warningStatus = 0;
+    byte warningChanges = 0;
+
+    // Charge overcurrent protection (mA), sliding window of CC samples
+    long occThreshold_mA = 0;             // 0 = disabled
+    long occWindow[OCC_MAX_WINDOW];
+    long occWindowSum = 0;
+    byte occWindowLength = 1;
+    byte occWindowCount = 0;
+    byte occWindowIndex = 0;
+    unsigned long occTripTimestamp = 0;
+    bool occRestoreCharging = false;      // CHG was on at the trip, switch it back on
+    bool tempRestoreCharging = false;     // same for the temperature trips
+    bool tempRestoreDischarging = false;
     bool autoBalancingEnabled = false;
     bool balancingActive = false;
+    unsigned int balancingStatus = 0;     // cells with balancing switched on, bit 0 = cell 1
+    unsigned int balancingPrevious = 0;   // cells balanced before the last swap
+    bool balancingAlternate = false;
+    unsigned long balancingSwapTimestamp = 0;
+    byte cellbalRegisters[3] = {0xFF, 0xFF, 0xFF};  // last written, 0xFF = unknown
+
+    // PROTECT1, PROTECT2, PROTECT3, OV_TRIP, UV_TRIP as set by the limit
+    // setters, initialized with the reset values of the IC
+    byte protectImage[5] = {0x00, 0x00, 0x00, 0xAC, 0x97};
+    bool protectBatch = false;            // setters only update protectImage
+    bool protectVerified = false;
     int balancingMinIdleTime_s = 1800;    // default: 30 minutes
     unsigned long idleTimestamp = 0;
-    
-		unsigned int secSinceErrorCounter = 0;
-		unsigned long interruptTimestamp = 0;
 
-		static bq769x0* instancePointer;
-    i2c_t3 *_wire;
+    // Fault recovery state per SYS_STAT fault bit
+    byte faultActive = 0;                           // faults in recovery
+    byte faultGone = 0;                             // in recovery but read clear
+    unsigned long faultGoneTimestamp[NUM_FAULTS];   // first read clear
+    byte faultRetries[NUM_FAULTS];                  // clear attempts, for the backoff
+    unsigned long faultDeadline[NUM_FAULTS];        // next attempt to clear
+
+		static bq769x0* instances[BQ769X0_MAX_INSTANCES];
+		static void (* const alertISRs[BQ769X0_MAX_INSTANCES])(void);
+    byte alertPin = 0xFF;
+    i2c_t3 *_wire = 0;
+
+    // I2C link state
+    i2c_link_stats linkStats = {0, 0, 0, 0, I2C_CLOCK_MIN};
+    unsigned long clockMin = I2C_CLOCK_MIN;
+    unsigned long clockMax = I2C_CLOCK_MAX;
+    unsigned int windowTransfers = 0;
+    byte windowErrors = 0;
+    bool cellRequestSent = false;       // block read started by requestCellVoltages()
   
   // Methods
   
-		static void alertISR(void);
+		template <byte slot> static void alertISR(void) { dispatchAlert(slot); }
+		static void dispatchAlert(byte slot);
     
 		void  updateVoltages(void);
+		void  updatePackVoltage(void);
+		void  requestCellVoltages(void);
+		void  readCellVoltages(void);
 		void  updateCurrent(bool ignoreCCReadyFlag = false);
 		void  updateTemperatures(void);
+		void  updateResistanceEstimate(void);
+		void  checkChargeOvercurrent(void);
+		void  checkTemperatureLimits(void);
+		byte  tripFets(byte mask);
+		void  updateTemperatureFlag(int flag, bool trip, bool clear, int temperature);
+		void  updateWarnings(bool temperaturesUpdated);
+		void  updateWarning(byte warning, int value);
     
     byte updateBalancingSwitches(void);
+    unsigned int selectBalancingCells(unsigned int excludedCells);
+    void writeBalancingRegisters(unsigned int flags);
+    void invalidateBalancingRegisters();
 
-		int  readRegister(byte address);
-		void writeRegister(byte address, uint8_t data);
+		int  readRegister(byte address);    // -1 if the read failed
+		bool writeRegister(byte address, uint8_t data);
+		bool writeBlock(byte address, const uint8_t *data, byte length);
+		bool writeProtectRegisters(void);
+		bool readBlock(byte address, uint8_t *data, byte length);
+		bool decodeBlock(const uint8_t *raw, uint8_t *data, byte length);
+		void linkResult(bool crcError, bool busError);
+		void stepClock(bool up);
 		
 };
 
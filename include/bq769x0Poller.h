@@ -0,0 +1,39 @@
+#ifndef BQ769X0POLLER_H
+#define BQ769X0POLLER_H
+
+#include <Arduino.h>
+#include "bq769x0CRC.h"
+
+/*
+ * Round-robin update scheduler for several bq769x0 ICs
+ *
+ * Every pack is updated once per BQ769X0_POLL_TICKS ticks. Packs on the same
+ * I2C bus are spread evenly over that period so they never compete for the
+ * bus, packs on different buses are given the same tick: their cell voltage
+ * block reads are started together with beginUpdate() and run in parallel on
+ * Wire and Wire1 before finishUpdate() collects them.
+ */
+
+#define BQ769X0_POLL_TICKS 25   // 10 ms ticks per update of one pack (250 ms)
+
+class bq769x0Poller {
+  public:
+    // returns false if BQ769X0_MAX_INSTANCES packs were already added
+    bool addPack(bq769x0 *pack);
+
+    // call every 10 ms tick, returns a bitmask of the packs updated in this tick
+    uint8_t tick(void);
+
+    bq769x0 *getPack(uint8_t index);
+    uint8_t getNumberOfPacks(void);
+
+  private:
+    bq769x0 *packs[BQ769X0_MAX_INSTANCES];
+    uint8_t tickOffset[BQ769X0_MAX_INSTANCES];
+    uint8_t numPacks = 0;
+    uint8_t tickCount = 0;
+
+    void assignOffsets(void);
+};
+
+#endif // BQ769X0POLLER_H
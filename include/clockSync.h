@@ -0,0 +1,37 @@
+#ifndef CLOCKSYNC_H
+#define CLOCKSYNC_H
+
+#include <Arduino.h>
+
+/*
+ * Host clock synchronization
+ *
+ * The host sends its clock (ms) in sync requests. Each request is one
+ * measurement of the offset between host time and millis(). The offset is
+ * tracked with a simple PLL: a new measurement corrects the offset by half
+ * its error and, at most every CLOCK_DRIFT_MIN_INTERVAL_MS, the drift by a
+ * quarter of the error rate between two raw measurements that far apart
+ * (the corrected offset already holds half of the error and would bias the
+ * drift). clockHostTime() converts any millis() value into the host time
+ * base, so samples can be stamped with the time they were taken.
+ * test/test_clocksync runs the loop against a drifting host clock.
+ *
+ * The host may pass the one way latency of the link (half its measured
+ * round trip) with the request, it is added to the host time.
+ */
+
+#define CLOCK_DRIFT_MIN_INTERVAL_MS 60000   // shorter intervals only update the offset
+#define CLOCK_MAX_DRIFT_PPM         2000    // crystal drift is far below this
+
+/* One measurement: host time when the request was sent, its latency, and
+ * millis() when it arrived */
+void clockSyncUpdate(uint32_t host_ms, uint16_t latency_ms, unsigned long local_ms);
+
+/* millis() value converted to host time, millis() itself until synced */
+uint32_t clockHostTime(unsigned long local_ms);
+
+bool clockSynced();
+int32_t clockOffset();      // host time - millis() at the last sync (ms)
+int32_t clockDrift();       // ppm, host clock faster than millis() if positive
+
+#endif // CLOCKSYNC_H
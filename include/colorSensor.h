@@ -0,0 +1,73 @@
+#ifndef COLORSENSOR_H
+#define COLORSENSOR_H
+
+#include <Arduino.h>
+
+/*
+ * Color sensor processing
+ *
+ * Converts each raw R/G/B/C sample from the sensor link into chromaticity,
+ * illuminance and correlated color temperature as it arrives, in fixed
+ * point, so the host reads finished values instead of raw counts.
+ *
+ * R, G and B are mapped to CIE XYZ with a 3x3 calibration matrix
+ * (Q12 coefficients). x and y follow from XYZ, illuminance is Y times a
+ * lux scale (Q8) given for COLOR_LUX_INTEGRATION_MS and scaled to the
+ * integration time in use, and the color temperature uses McCamy's
+ * approximation.
+ * It is only meaningful for light near the Planckian locus (about 2000 to
+ * 12000 K), but the distance from the locus is not checked: cct is 0 only
+ * where the approximation itself runs off (y close to or below its
+ * epicenter, or outside its range of n). A saturated green or magenta light
+ * still gets a value, judge it from x and y.
+ *
+ * The default matrix is the generic one for TCS3472 type sensors behind
+ * clear glass; measure a reference light to calibrate a specific build.
+ *
+ * The sensor clips at 1024 counts per 2.4 ms integration cycle, up to
+ * 65535, so the saturation count follows the integration time the sensor
+ * link configures.
+ */
+
+#define COLOR_SAMPLE_SIZE   8         // R, G, B, C, 16 bit each, high byte first
+#define COLOR_MAX_COUNT     0xFFFF    // 16 bit channels
+#define COLOR_CYCLE_US      2400      // one integration cycle
+#define COLOR_CYCLE_COUNTS  1024      // full scale per cycle
+#define COLOR_LUX_INTEGRATION_MS 50   // integration time luxScale is given for
+#define COLOR_MIN_CLEAR     16        // less light than this gives no chromaticity
+
+// color_result.flags
+#define COLOR_VALID         0x01      // x, y and cct hold a result
+#define COLOR_SATURATED     0x02      // clear channel clipped, values too low
+#define COLOR_DARK          0x04      // too little light for chromaticity
+
+typedef struct __attribute__((packed)) {
+  int16_t   matrix[9];      // XYZ = matrix * RGB, row by row, Q12
+  uint16_t  luxScale;       // lux per Y count at COLOR_LUX_INTEGRATION_MS, Q8
+} color_calibration;
+
+typedef struct {
+  uint16_t  x;              // chromaticity, 1/65536
+  uint16_t  y;
+  uint32_t  lux;
+  uint16_t  cct;            // K, 0 where McCamy does not apply
+  uint8_t   flags;          // COLOR_*
+} color_result;
+
+extern const color_calibration colorDefaultCalibration;
+
+// Processes one raw sample of COLOR_SAMPLE_SIZE bytes
+void colorUpdate(const uint8_t *sample);
+
+// Latest result, flags are 0 before the first sample
+const color_result &colorResult();
+
+/* Integration time the sensor runs with, sets the clear count that is
+ * flagged as saturated and scales the lux */
+void colorSetIntegrationTime(uint16_t integration_ms);
+uint16_t colorSaturation();
+
+void colorSetCalibration(const color_calibration &calibration);
+const color_calibration &colorCalibration();
+
+#endif // COLORSENSOR_H
@@ -0,0 +1,30 @@
+#ifndef EEPROMLAYOUT_H
+#define EEPROMLAYOUT_H
+
+/*
+ * Allocation of the Teensy LC's 128 bytes of emulated EEPROM
+ *
+ * Every user of EEPROM gets a fixed region here so they can never overlap.
+ */
+
+#define EEPROM_SIZE             128
+
+// Battery health records, wear leveled over EEPROM_HEALTH_SLOTS slots
+#define EEPROM_HEALTH_START     0
+#define EEPROM_HEALTH_SLOTS     4
+#define EEPROM_HEALTH_END       (EEPROM_HEALTH_START + EEPROM_HEALTH_SLOTS * 10)
+
+// Fault journal, ring of EEPROM_JOURNAL_ENTRIES 8 byte entries
+#define EEPROM_JOURNAL_START    EEPROM_HEALTH_END
+#define EEPROM_JOURNAL_ENTRIES  7
+#define EEPROM_JOURNAL_END      (EEPROM_JOURNAL_START + EEPROM_JOURNAL_ENTRIES * 8)
+
+// BMS configuration record, a single copy as it is rarely written
+#define EEPROM_CONFIG_START     EEPROM_JOURNAL_END
+#define EEPROM_CONFIG_END       (EEPROM_CONFIG_START + 32)
+
+#if EEPROM_CONFIG_END > EEPROM_SIZE
+#error "EEPROM layout does not fit into the Teensy LC EEPROM"
+#endif
+
+#endif // EEPROMLAYOUT_H
@@ -0,0 +1,53 @@
+#ifndef FAULTJOURNAL_H
+#define FAULTJOURNAL_H
+
+#include <Arduino.h>
+#include "bq769x0CRC.h"
+
+/*
+ * Persistent fault journal
+ *
+ * journalUpdate() compares the BMS error flags (SYS_STAT bits and STAT_SW_*
+ * flags) with the previous call and queues one entry per flag that was set or
+ * cleared, with the lowest and highest cell voltage at that moment. That
+ * pair at 8 mV resolution is the whole cell snapshot; per-cell voltages
+ * would not fit the 128 bytes of EEPROM.
+ * journalFlush() writes queued entries into an append-only ring in EEPROM
+ * from the main loop's slack time, at most JOURNAL_WRITE_BURST entries at
+ * once and one more every JOURNAL_WRITE_INTERVAL_MS, so a flapping fault
+ * cannot wear out the EEPROM. Entries that do not fit are counted and
+ * reported in a JOURNAL_DROPPED entry.
+ */
+
+#define JOURNAL_QUEUE_SIZE          4
+#define JOURNAL_WRITE_BURST         4
+#define JOURNAL_WRITE_INTERVAL_MS   10000
+#define JOURNAL_ENTRIES_PER_FRAME   4
+
+#define JOURNAL_SET                 0x80    // event bit 7: flag was set, else cleared
+#define JOURNAL_DROPPED             0x7F    // event: minCell holds the number of lost entries
+#define JOURNAL_CRC_XOR             0xA5    // the CRC of zero bytes is 0, a zeroed entry must not check
+
+typedef struct {
+  uint8_t   sequence;     // wraps, the entry after the newest one is the oldest
+  uint8_t   event;        // JOURNAL_SET | bit number + 1 of the flag in getErrorStatus()
+  uint8_t   uptime[3];    // seconds since boot, little endian
+  uint8_t   minCell;      // (mV - 2000) / 8
+  uint8_t   maxCell;      // (mV - 2000) / 8
+  uint8_t   crc;          // CRC-8 (SMBus) of the bytes above ^ JOURNAL_CRC_XOR
+} __attribute__((packed)) journal_entry;
+
+/* Loads the journal from EEPROM */
+void journalSetup();
+
+/* Call after every BMS.update() */
+void journalUpdate(bq769x0 &bms);
+
+/* Writes queued entries to EEPROM, call from slack time */
+void journalFlush();
+
+/* Sends the journal oldest first, as frames of
+ * [5, frame index, number of entries, entries...] */
+void journalSend(void (*send)(const uint8_t *buffer, size_t size));
+
+#endif // FAULTJOURNAL_H
@@ -0,0 +1,96 @@
+#ifndef I2CTRACE_H
+#define I2CTRACE_H
+
+#include <Arduino.h>
+
+/*
+ * I2C transaction recorder of the bq769x0 driver
+ *
+ * Every transfer attempt of the driver (register and block reads, writes)
+ * is stored as an 8 byte record in a RAM ring that keeps the newest
+ * I2C_TRACE_SIZE records, together with the driver method that caused it.
+ * The start of each update() pass is marked, so a capture can be split into
+ * passes. Recording is off until traceStart(); traceSend() downloads the
+ * ring for offline analysis with tools/i2creplay.
+ *
+ * The recorder costs 256 bytes of RAM and some work on every transfer, so
+ * it is compiled in only with BQ769X0_TRACE=1 (build_flags, set for the
+ * native envs). Without it the driver has no tracing code at all and the
+ * Onion trace command is ignored.
+ */
+
+#ifndef BQ769X0_TRACE
+#define BQ769X0_TRACE 0
+#endif
+
+#define I2C_TRACE_SIZE              32      // records, must be a power of 2
+#define I2C_TRACE_RECORDS_PER_FRAME 16
+
+// flags: bits 0..1 operation, bit 2 failed, bits 3..5 bus clock in 100 kHz
+#define TRACE_READ          0
+#define TRACE_WRITE         1
+#define TRACE_MARK          2       // start of an update() pass, no transfer
+#define TRACE_OP_MASK       0x03
+#define TRACE_FAILED        0x04
+#define TRACE_CLOCK_SHIFT   3
+
+// driver method that caused a transfer
+enum i2c_trace_caller {
+  TRACE_OTHER         = 0,
+  TRACE_BEGIN         = 1,
+  TRACE_STATUS        = 2,  // checkStatus()
+  TRACE_CURRENT       = 3,  // updateCurrent()
+  TRACE_CELLS         = 4,  // cell voltage block read
+  TRACE_PACK          = 5,  // pack voltage
+  TRACE_TEMPERATURES  = 6,
+  TRACE_BALANCING     = 7,
+  TRACE_CONFIG        = 8,  // limit setters and applyConfig()
+  TRACE_FETS          = 9,  // enable/disable charging and discharging
+  TRACE_CALLERS       = 10
+};
+
+typedef struct {
+  uint16_t  time;       // millis(), low 16 bits
+  uint8_t   address;    // 7 bit slave address
+  uint8_t   flags;
+  uint8_t   caller;     // i2c_trace_caller
+  uint8_t   reg;        // first register
+  uint8_t   length;     // data bytes, without CRC bytes
+  uint8_t   data;       // the data byte, CRC-8 of the data for blocks
+} __attribute__((packed)) i2c_trace_record;
+
+void traceStart();      // clears the ring and starts recording
+void traceStop();
+
+/* Sends the ring oldest first, as frames of
+ * [8, frame index, number of records, records lost lo, hi, records...]
+ * A frame with less than I2C_TRACE_RECORDS_PER_FRAME records is the last. */
+void traceSend(void (*send)(const uint8_t *buffer, size_t size));
+
+/* Used by the driver */
+void traceRecord(uint8_t address, uint8_t flags, uint8_t reg, const uint8_t *data,
+  uint8_t length, unsigned long clock);
+
+extern uint8_t traceCaller;
+
+// Attributes the transfers of the enclosing scope to a caller, restores the
+// previous one on return so nested calls (checkStatus() in enableCharging())
+// are counted where they happen
+class i2c_trace_scope {
+  public:
+    i2c_trace_scope(uint8_t caller) : previous(traceCaller) { traceCaller = caller; }
+    ~i2c_trace_scope() { traceCaller = previous; }
+  private:
+    uint8_t previous;
+};
+
+#if BQ769X0_TRACE
+#define TRACE_CALLER(caller) i2c_trace_scope traceScope(caller)
+#define TRACE_TRANSFER(flags, reg, data, length) \
+  traceRecord(I2CAddress, flags, reg, data, length, linkStats.clock)
+#else
+#define TRACE_CALLER(caller)
+#define TRACE_TRANSFER(flags, reg, data, length)
+#endif
+
+#endif // I2CTRACE_H
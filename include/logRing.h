@@ -0,0 +1,60 @@
+#ifndef LOGRING_H
+#define LOGRING_H
+
+#include <Arduino.h>
+
+/*
+ * Non-blocking binary event log
+ *
+ * logEvent() copies a record into a RAM ring in constant time and never
+ * touches the USB stack. logDrain() is called from the main loop's slack
+ * time and only writes as many records as the USB Serial buffer can take
+ * without blocking. Use tools/logdecode.py to turn the stream back into text.
+ *
+ * Frame on the wire (little endian, 11 bytes):
+ *   [LOG_SYNC][timestamp ms:4][event:1][arg0:2][arg1:2][checksum:1]
+ * checksum is the XOR of all bytes between sync and checksum.
+ */
+
+#define LOG_SYNC        0xA5
+#define LOG_RING_SIZE   32      // records, must be a power of 2
+#define LOG_FRAME_SIZE  11
+
+typedef struct {
+  uint32_t  timestamp;  // millis() when the event was logged
+  uint8_t   event;      // log_event id
+  int16_t   arg0;
+  int16_t   arg1;
+} log_record;
+
+/* Event ids, tools/logdecode.py reads names from this enum */
+enum log_event {
+  LOG_BOOT            = 0,
+  LOG_DROPPED         = 1,  // arg0: records dropped since last drain
+  LOG_BMS_BEGIN       = 2,  // arg0: 0 on success
+  LOG_BMS_XR_CLEAR    = 3,  // arg0: SYS_STAT
+  LOG_BMS_ALERT_CLEAR = 4,  // arg0: SYS_STAT
+  LOG_BMS_UV_CLEAR    = 5,  // arg0: SYS_STAT, arg1: min cell mV
+  LOG_BMS_OV_CLEAR    = 6,  // arg0: SYS_STAT, arg1: max cell mV
+  LOG_BMS_SCD_CLEAR   = 7,  // arg0: SYS_STAT
+  LOG_BMS_OCD_CLEAR   = 8,  // arg0: SYS_STAT
+  LOG_BMS_CHG_ON      = 9,  // arg0: max cell mV
+  LOG_BMS_OCC_TRIP    = 10, // arg0: charge current in 100 mA
+  LOG_BMS_OCC_CLEAR   = 11, // arg0: charge current in 100 mA
+  LOG_BMS_TEMP_TRIP   = 12, // arg0: STAT_SW_* flag, arg1: °C/10
+  LOG_BMS_TEMP_CLEAR  = 13, // arg0: STAT_SW_* flag, arg1: °C/10
+  LOG_HEALTH_RESTORE  = 14, // arg0: capacity mAh, arg1: cycles
+  LOG_HEALTH_CAPACITY = 15, // arg0: measured mAh, arg1: learned mAh
+  LOG_BMS_I2C_CLOCK   = 16, // arg0: new bus clock kHz, arg1: errors in the window
+  LOG_BMS_I2C_FAIL    = 17, // arg0: register, arg1: transfers failed so far
+  LOG_BMS_CONFIG      = 18, // arg0: 1 if verified, arg1: OV_TRIP << 8 | UV_TRIP
+  LOG_SENSOR_TIMEOUT  = 19, // first of an outage, arg0: timeouts so far, arg1: sample period ms
+};
+
+/* Queue an event, safe to call from interrupts. Drops the record if full */
+void logEvent(uint8_t event, int16_t arg0 = 0, int16_t arg1 = 0);
+
+/* Write queued records to USB Serial without blocking */
+void logDrain();
+
+#endif // LOGRING_H
@@ -3,6 +3,9 @@
 
 int makeColor(unsigned int hue, unsigned int saturation, unsigned int lightness);
 
+// Multiply/shift only, within +-1 per channel of makeColor()
+int makeColorFast(unsigned int hue, unsigned int saturation, unsigned int lightness);
+
 unsigned int h2rgb(unsigned int v1, unsigned int v2, unsigned int hue);
 
 #endif // MAKECOLOR_H
\ No newline at end of file
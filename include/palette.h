@@ -0,0 +1,116 @@
+#ifndef PALETTE_H
+#define PALETTE_H
+
+#include <stdint.h>
+
+/*
+ * Compile-time color palettes
+ *
+ * makeColorConst() is the constexpr twin of makeColor() and gives the same
+ * result for the same inputs. Palettes declared with HSL_PALETTE() are
+ * computed by the compiler and live in flash, so they cost no RAM and no
+ * boot time.
+ *
+ * Written in C++11 constexpr style (single return) so it builds with
+ * any Teensy toolchain.
+ */
+
+constexpr unsigned int h2rgbConst(unsigned int v1, unsigned int v2, unsigned int hue)
+{
+	return (hue < 60) ? v1 * 60 + (v2 - v1) * hue :
+	       (hue < 180) ? v2 * 60 :
+	       (hue < 240) ? v1 * 60 + (v2 - v1) * (240 - hue) :
+	       v1 * 60;
+}
+
+constexpr int rgbConst(unsigned int red, unsigned int green, unsigned int blue)
+{
+	return (red << 16) | (green << 8) | blue;
+}
+
+constexpr int makeColorVarConst(unsigned int hue, unsigned int var1, unsigned int var2)
+{
+	return rgbConst(h2rgbConst(var1, var2, (hue < 240) ? hue + 120 : hue - 240) * 255 / 600000,
+	                h2rgbConst(var1, var2, hue) * 255 / 600000,
+	                h2rgbConst(var1, var2, (hue >= 120) ? hue - 120 : hue + 240) * 255 / 600000);
+}
+
+constexpr int makeColorSatConst(unsigned int hue, unsigned int lightness, unsigned int var2)
+{
+	return makeColorVarConst(hue, lightness * 200 - var2, var2);
+}
+
+// Same arguments and result as makeColor()
+constexpr int makeColorConst(unsigned int hue, unsigned int saturation, unsigned int lightness)
+{
+	return (hue > 359) ? makeColorConst(hue % 360, saturation, lightness) :
+	       (saturation > 100) ? makeColorConst(hue, 100, lightness) :
+	       (lightness > 100) ? makeColorConst(hue, saturation, 100) :
+	       (saturation == 0) ? rgbConst(lightness * 255 / 100, lightness * 255 / 100, lightness * 255 / 100) :
+	       makeColorSatConst(hue, lightness,
+	                         (lightness < 50) ? lightness * (100 + saturation) :
+	                         ((lightness + saturation) * 100) - (saturation * lightness));
+}
+
+// Fixed size color table, indexable like a plain array
+template <unsigned int N>
+struct Palette {
+	int colors[N];
+
+	constexpr int operator[](unsigned int i) const { return colors[i]; }
+	constexpr unsigned int size() const { return N; }
+};
+
+// Index list used to expand one makeColorConst() call per palette entry
+template <unsigned int... Is> struct PaletteIndex {};
+template <unsigned int N, unsigned int... Is>
+struct MakePaletteIndex : MakePaletteIndex<N - 1, N - 1, Is...> {};
+template <unsigned int... Is>
+struct MakePaletteIndex<0, Is...> { typedef PaletteIndex<Is...> type; };
+
+template <unsigned int N, unsigned int... Is>
+constexpr Palette<N> makeHslPalette(unsigned int hueStart, unsigned int hueStep,
+                                    unsigned int saturation, unsigned int lightness,
+                                    PaletteIndex<Is...>)
+{
+	return Palette<N>{{ makeColorConst(hueStart + Is * hueStep, saturation, lightness)... }};
+}
+
+// N colors starting at hueStart, hueStep degrees apart
+template <unsigned int N>
+constexpr Palette<N> makeHslPalette(unsigned int hueStart, unsigned int hueStep,
+                                    unsigned int saturation, unsigned int lightness)
+{
+	return makeHslPalette<N>(hueStart, hueStep, saturation, lightness,
+	                         typename MakePaletteIndex<N>::type());
+}
+
+// Gamma correction table, 8 bit input to 8.8 fixed point output.
+// Approximates gamma 2.2 as 0.8 x^2 + 0.2 x^3 so it stays constexpr.
+struct GammaTable {
+	uint16_t levels[256];
+
+	constexpr uint16_t operator[](unsigned int i) const { return levels[i]; }
+};
+
+constexpr uint16_t gammaLevelConst(unsigned long long v)
+{
+	return (uint16_t)(((4 * v * v * 255 + v * v * v) * 256 + 5 * 255 * 255 / 2) / (5 * 255 * 255));
+}
+
+template <unsigned int... Is>
+constexpr GammaTable makeGammaTable(PaletteIndex<Is...>)
+{
+	return GammaTable{{ gammaLevelConst(Is)... }};
+}
+
+constexpr GammaTable makeGammaTable()
+{
+	return makeGammaTable(MakePaletteIndex<256>::type());
+}
+
+// Declare a named palette that is computed at compile time and kept in flash
+#define HSL_PALETTE(name, count, hueStart, hueStep, saturation, lightness) \
+	constexpr Palette<count> name = makeHslPalette<count>(hueStart, hueStep, saturation, lightness)
+
+#endif // PALETTE_H
@@ -0,0 +1,73 @@
+#ifndef SENSORLINK_H
+#define SENSORLINK_H
+
+#include <Arduino.h>
+
+/*
+ * Color sensor link control
+ *
+ * The sensor MCU streams samples over COBS frames on Serial3. This side
+ * sends control frames back on the same link:
+ *
+ *   [SENSOR_CTRL_CONFIG][period ms][integration ms]   16 bit, high byte first
+ *   [SENSOR_CTRL_FLOW][0 pause / 1 resume]
+ *
+ * Data frames are the 8 byte sample, optionally followed by a sequence
+ * number that is incremented per sample, which lets lost samples be counted.
+ * The count restarts after a timeout, when the sensor may have rebooted.
+ * Samples arriving faster than 4/3 of the configured rate, measured over
+ * SENSOR_RATE_WINDOW_PERIODS, are counted as early (over-sampling).
+ *
+ * Serial3 only buffers 64 bytes, about six frames. If the main loop is busy
+ * and the receive buffer fills past SENSOR_RX_HIGH_WATER, the sensor is
+ * paused until it drains below SENSOR_RX_LOW_WATER. The level is only seen
+ * when sensorLinkUpdate() is called, so it has to be called around the long
+ * work of the loop; a single stall longer than the buffer holds (about six
+ * periods, 60 ms at the shortest period) still overflows it.
+ *
+ * Control frames are not acknowledged, so configuration and resume are sent
+ * again if no sample arrives for SENSOR_TIMEOUT_PERIODS periods, which also
+ * covers a sensor that rebooted with its defaults.
+ */
+
+#define SENSOR_CTRL_CONFIG      0x01
+#define SENSOR_CTRL_FLOW        0x02
+
+#define SENSOR_RX_HIGH_WATER    40    // bytes waiting in the Serial3 buffer
+#define SENSOR_RX_LOW_WATER     10
+#define SENSOR_TIMEOUT_PERIODS  4
+#define SENSOR_MIN_PERIOD_MS    10    // the main loop tick
+
+#define SENSOR_RATE_WINDOW_PERIODS      32    // well past a drained backlog of six frames
+#define SENSOR_DEFAULT_PERIOD_MS        100   // until configured
+#define SENSOR_DEFAULT_INTEGRATION_MS   50
+
+typedef struct {
+  uint32_t  samples;      // valid data frames
+  uint32_t  badFrames;    // frames of another size
+  uint32_t  lost;         // gaps in the sequence numbers
+  uint32_t  early;        // samples above 4/3 of the configured rate, over-sampling
+  uint32_t  pauses;       // times the sensor was paused for a full buffer
+  uint32_t  timeouts;     // times the configuration had to be sent again
+} sensor_link_stats;
+
+/* Sends the default configuration and resumes the sensor */
+void sensorLinkSetup(void (*send)(const uint8_t *buffer, size_t size));
+
+/* Returns 1 if period and integration time are usable (integration not
+ * longer than the period) and were sent to the sensor */
+bool sensorLinkConfigure(uint16_t period_ms, uint16_t integration_ms);
+
+uint16_t sensorLinkPeriod();
+uint16_t sensorLinkIntegration();
+
+/* Checks one received frame, returns 1 if it holds a sample */
+bool sensorLinkReceive(const uint8_t *buffer, size_t size, unsigned long now);
+
+/* Flow control and timeouts, call every tick and after long work with
+ * Serial3.available() */
+void sensorLinkUpdate(int rxWaiting, unsigned long now);
+
+const sensor_link_stats &sensorLinkStats();
+
+#endif // SENSORLINK_H
@@ -1,6 +1,6 @@
 #include "RGBleds.h"
 
-const uint8_t ledsPerStrip = 20;
+const uint8_t ledsPerStrip = RGB_LEDS_PER_STRIP;
 
 // LED strip setup configs
 DMAMEM int displayMemory[ledsPerStrip*6]; // OctoWS2811 library docs state you need times 6 # LEDs
@@ -8,32 +8,261 @@ int drawingMemory[ledsPerStrip*6];
 const int RGBconfig = WS2811_GRB | WS2811_800kHz;
 OctoWS2811 leds(ledsPerStrip, displayMemory, drawingMemory, RGBconfig);
 
-int rainbowColors[180];
-uint8_t color = 0;
+#define RGB_NUM_PIXELS (RGB_MAX_STRIPS * ledsPerStrip)
+
+// Render layer state, pixels only reach OctoWS2811 when they change
+int frameColors[RGB_NUM_PIXELS];                // last color set per pixel
+uint8_t pixelDirty[(RGB_NUM_PIXELS + 7) / 8];   // one bit per pixel
+bool frameDirty = false;                        // frame differs from the one shown
+uint8_t ticksPerFrame = 1;                      // show() rate limit
+uint8_t frameTicks = 0;
+unsigned long framesShown = 0;
+unsigned long framesSkipped = 0;
+unsigned long stripsDeferred = 0;
+
+// Output stage, applied when pixels are packed for OctoWS2811
+constexpr GammaTable gammaLevels = makeGammaTable();   // in flash
+static_assert(gammaLevels[0] == 0 && gammaLevels[255] == 255 << 8,
+    "gamma table must map black to black and full to full");
+uint8_t brightness = 255;
+uint8_t colorBalance[3] = {255, 255, 255};  // red, green, blue
+uint16_t channelScale[3] = {256, 256, 256}; // brightness * balance, 256 = 1.0
+bool dithering = false;
+uint8_t ditherFrame = 0;
+
+// Ordered thresholds for the fractional 8 bits, offset per pixel and frame
+const uint8_t ditherThreshold[8] = { 16, 144, 80, 208, 48, 176, 112, 240 };
+
+// Logical strips, one per OctoWS2811 output
+typedef struct {
+    rgb_effect      effect;         // NULL if the output is unused
+    uint8_t         length;         // pixels, at most ledsPerStrip
+    uint8_t         ticksPerUpdate; // effect update period in 10ms ticks
+    uint8_t         ticks;
+    bool            due;            // waiting to be rendered
+    unsigned long   frame;          // frames rendered so far
+} rgb_strip;
+
+rgb_strip strips[RGB_MAX_STRIPS];
+uint8_t nextStrip = 0;              // round robin start, so no strip starves
+
+// 180 rainbow colors, hue 0 to 358 in steps of 2, computed at compile time
+HSL_PALETTE(rainbowColors, 180, 0, 2, 100, 50);
+static_assert(rainbowColors[0] == 0xFF0000 && rainbowColors[60] == 0x00FF00,
+    "rainbow palette does not match makeColor()");
+
+uint8_t fpsToTicks(uint8_t fps) {
+    if (fps == 0 || fps >= RGB_TICK_HZ) {
+        return 1;
+    }
+    return RGB_TICK_HZ / fps;
+}
 
 void rgbSetup() {
     leds.begin();
-    for (int i=0; i<180; i++) {
-        int hue = i * 2;
-        int saturation = 100;
-        int lightness = 50;
-        // pre-compute the 180 rainbow colors
-        rainbowColors[i] = makeColor(hue, saturation, lightness);
+}
+
+bool rgbAddStrip(uint8_t output, uint8_t length, rgb_effect effect, uint8_t fps) {
+    if (output >= RGB_MAX_STRIPS || length > ledsPerStrip || effect == NULL) {
+        return false;
+    }
+    rgb_strip *strip = &strips[output];
+    strip->effect = effect;
+    strip->length = length;
+    strip->ticksPerUpdate = fpsToTicks(fps);
+    strip->ticks = 0;
+    strip->due = true;
+    strip->frame = 0;
+
+    // blank pixels past the end of a shorter strip
+    for (uint8_t i = length; i < ledsPerStrip; i++) {
+        rgbSetStripPixel(output, i, 0);
     }
+    return true;
 }
 
-// For testing, this function will update the RGB leds to a gradient pattern down the stip of LEDs
-// Call rgbUpdate at whatever rate you want the LEDs to cycle through colors.
-void rgbUpdate() {
-    int x;
+void rgbSetPixel(uint16_t index, int rgb) {
+    if (index >= RGB_NUM_PIXELS || frameColors[index] == rgb) {
+        return;
+    }
+    frameColors[index] = rgb;
+    pixelDirty[index >> 3] |= 1 << (index & 7);
+    frameDirty = true;
+}
+
+void rgbSetStripPixel(uint8_t output, uint8_t index, int rgb) {
+    if (index < ledsPerStrip) {
+        rgbSetPixel(output * ledsPerStrip + index, rgb);
+    }
+}
+
+// Forces every pixel to be packed again, used when the output stage changes
+void markAllDirty() {
+    memset(pixelDirty, 0xFF, sizeof(pixelDirty));
+    frameDirty = true;
+}
+
+void updateChannelScale() {
+    for (uint8_t ch = 0; ch < 3; ch++) {
+        // (b+1)*(c+1) >> 8 maps 255*255 to 256 and 0 to 0
+        channelScale[ch] = ((brightness + 1) * (colorBalance[ch] + 1)) >> 8;
+        if (brightness == 0 || colorBalance[ch] == 0) {
+            channelScale[ch] = 0;
+        }
+    }
+    markAllDirty();
+}
+
+void rgbSetBrightness(uint8_t level) {
+    if (level != brightness) {
+        brightness = level;
+        updateChannelScale();
+    }
+}
+
+void rgbSetColorBalance(uint8_t red, uint8_t green, uint8_t blue) {
+    colorBalance[0] = red;
+    colorBalance[1] = green;
+    colorBalance[2] = blue;
+    updateChannelScale();
+}
+
+void rgbSetDithering(bool enable) {
+    dithering = enable;
+    markAllDirty();
+}
+
+// Gamma, brightness and dithering for one channel, 8.8 fixed point inside
+uint8_t correctChannel(uint8_t value, uint8_t ch, uint8_t threshold) {
+    unsigned long level = ((unsigned long)gammaLevels[value] * channelScale[ch]) >> 8;
+    level += threshold;
+    return (level > 0xFFFF) ? 0xFF : level >> 8;
+}
+
+int correctColor(int rgb, uint16_t index) {
+    uint8_t threshold = 128;    // round to nearest without dithering
+    if (dithering) {
+        threshold = ditherThreshold[(index + ditherFrame) & 7];
+    }
+    return (correctChannel((rgb >> 16) & 0xFF, 0, threshold) << 16) |
+        (correctChannel((rgb >> 8) & 0xFF, 1, threshold) << 8) |
+        correctChannel(rgb & 0xFF, 2, threshold);
+}
+
+void rgbSetFrameRate(uint8_t fps) {
+    ticksPerFrame = fpsToTicks(fps);
+}
+
+unsigned long rgbFramesShown() {
+    return framesShown;
+}
+
+unsigned long rgbFramesSkipped() {
+    return framesSkipped;
+}
+
+unsigned long rgbStripsDeferred() {
+    return stripsDeferred;
+}
+
+int rgbScale(int rgb, uint8_t level) {
+    int red = (((rgb >> 16) & 0xFF) * level) >> 8;
+    int green = (((rgb >> 8) & 0xFF) * level) >> 8;
+    int blue = ((rgb & 0xFF) * level) >> 8;
+    return (red << 16) | (green << 8) | blue;
+}
+
+// For testing, draws a gradient pattern down the strip that moves one step per frame
+void rgbRainbowEffect(uint8_t output, uint8_t length, unsigned long frame) {
     const uint8_t phaseShift = 10;
-    for (x=0; x < ledsPerStrip; x++) {
-    int index = (color + x + phaseShift/2) % 180;
-    leds.setPixel(x, rainbowColors[index]);
+    uint8_t index = (frame + phaseShift/2) % 180;
+    for (uint8_t x = 0; x < length; x++) {
+        rgbSetStripPixel(output, x, rainbowColors[index]);
+        if (++index >= 180) {
+            index = 0;
+        }
+    }
+}
+
+// Runs the effects that are due, starting where the last frame stopped.
+// Strips that do not fit in RGB_FRAME_BUDGET_US stay due for the next tick.
+void rgbRender() {
+    unsigned long start = micros();
+    uint8_t output = nextStrip;
+
+    for (uint8_t n = 0; n < RGB_MAX_STRIPS; n++) {
+        rgb_strip *strip = &strips[output];
+        if (strip->due) {
+            if (micros() - start >= RGB_FRAME_BUDGET_US) {
+                nextStrip = output;
+                stripsDeferred++;
+                return;
+            }
+            strip->effect(output, strip->length, strip->frame);
+            strip->frame++;
+            strip->due = false;
+        }
+        if (++output >= RGB_MAX_STRIPS) {
+            output = 0;
+        }
+    }
+    nextStrip = output;
+}
+
+// Packs changed pixels through the output stage into the drawing buffer and
+// starts a DMA transfer, unless the frame is identical to the one shown
+void rgbShow() {
+    for (uint8_t i = 0; i < sizeof(pixelDirty); i++) {
+        if (pixelDirty[i] == 0) {
+            continue;
+        }
+        for (uint8_t bit = 0; bit < 8; bit++) {
+            if (pixelDirty[i] & (1 << bit)) {
+                leds.setPixel(i*8 + bit, correctColor(frameColors[i*8 + bit], i*8 + bit));
+            }
+        }
+        pixelDirty[i] = 0;
+    }
+
+    // show() would block until the previous transfer is done, retry next tick
+    if (leds.busy()) {
+        return;
     }
     leds.show();
-    color++;
-    if(color >= 180) {
-    color = 0;
+    frameDirty = false;
+    framesShown++;
+
+    // the next dither step differs from this frame even if nothing else does
+    if (dithering) {
+        ditherFrame++;
+        markAllDirty();
     }
-}
\ No newline at end of file
+}
+
+// Call once per main loop tick
+void rgbUpdate() {
+    bool rendered = false;
+
+    for (uint8_t output = 0; output < RGB_MAX_STRIPS; output++) {
+        rgb_strip *strip = &strips[output];
+        if (strip->effect != NULL && ++strip->ticks >= strip->ticksPerUpdate) {
+            strip->ticks = 0;
+            strip->due = true;
+        }
+        rendered |= strip->due;
+    }
+    if (rendered) {
+        rgbRender();
+    }
+
+    if (++frameTicks < ticksPerFrame) {
+        return;
+    }
+    frameTicks = 0;
+    if (frameDirty) {
+        rgbShow();
+    }
+    else if (rendered) {
+        framesSkipped++;
+    }
+}
@@ -0,0 +1,150 @@
+#include <EEPROM.h>
+#include <FastCRC.h>
+
+#include "batteryHealth.h"
+#include "eepromLayout.h"
+#include "logRing.h"
+
+static_assert(sizeof(health_record) * EEPROM_HEALTH_SLOTS ==
+  EEPROM_HEALTH_END - EEPROM_HEALTH_START, "health record size does not match eepromLayout.h");
+
+#define MAS_PER_MAH 3600000L    // mA*ms per mAh
+
+static FastCRC8 healthCRC;
+
+static health_record health;               // current state, mirrors the newest record
+static uint8_t healthSlot = 0;             // slot of the newest record
+static uint16_t designCapacity = 0;        // mAh
+static int emptyCellVoltage = 3000;        // mV
+static int fullCellVoltage = 4200;         // mV
+
+// Coulomb counting
+static unsigned long lastUpdate = 0;
+static long dischargeRemainder = 0;        // mA*ms not yet counted as a whole mAh
+static bool measuring = false;             // discharging from full, capacity measurement running
+static uint16_t measured_mAh = 0;
+static uint16_t savedThroughput = 0;       // throughput_mAh in EEPROM
+
+static int slotAddress(uint8_t slot) {
+  return EEPROM_HEALTH_START + slot * sizeof(health_record);
+}
+
+static bool recordValid(const health_record &rec) {
+  return rec.version == HEALTH_RECORD_VERSION &&
+    rec.crc == healthCRC.smbus((const uint8_t *)&rec, sizeof(health_record) - 1);
+}
+
+// Writes the state into the slot after the newest one
+static void healthSave() {
+  health.sequence++;
+  health.version = HEALTH_RECORD_VERSION;
+  health.crc = healthCRC.smbus((const uint8_t *)&health, sizeof(health_record) - 1);
+
+  healthSlot = (healthSlot + 1) % EEPROM_HEALTH_SLOTS;
+  EEPROM.put(slotAddress(healthSlot), health);
+  savedThroughput = health.throughput_mAh;
+}
+
+void healthSetup(uint16_t designCapacity_mAh, int emptyCell_mV, int fullCell_mV) {
+  designCapacity = designCapacity_mAh;
+  emptyCellVoltage = emptyCell_mV;
+  fullCellVoltage = fullCell_mV;
+
+  // fixed number of slots, so finding the newest record takes constant time
+  bool found = false;
+  for (uint8_t slot = 0; slot < EEPROM_HEALTH_SLOTS; slot++) {
+    health_record rec;
+    EEPROM.get(slotAddress(slot), rec);
+    if (!recordValid(rec)) {
+      continue;
+    }
+    // sequence numbers wrap, compare the difference
+    if (!found || (int16_t)(rec.sequence - health.sequence) > 0) {
+      health = rec;
+      healthSlot = slot;
+      found = true;
+    }
+  }
+
+  savedThroughput = health.throughput_mAh;
+  if (!found) {
+    health.sequence = 0;
+    health.capacity_mAh = designCapacity_mAh;
+    health.cycles = 0;
+    health.throughput_mAh = 0;
+    healthSlot = EEPROM_HEALTH_SLOTS - 1;   // first save goes to slot 0
+    healthSave();
+  }
+  logEvent(LOG_HEALTH_RESTORE, health.capacity_mAh, health.cycles);
+
+  lastUpdate = millis();
+}
+
+void healthUpdate(bq769x0 &bms) {
+  unsigned long now = millis();
+  long dt = now - lastUpdate;
+  lastUpdate = now;
+
+  long current = bms.getBatteryCurrent();
+  bool changed = false;
+
+  // full: top cell reached the limit and the charger tapered off
+  if (bms.getMaxCellVoltage() >= fullCellVoltage &&
+    current >= 0 && current < HEALTH_FULL_TAPER_MA)
+  {
+    measuring = true;
+    measured_mAh = 0;
+  }
+  else if (current >= HEALTH_FULL_TAPER_MA) {
+    measuring = false;  // recharged before reaching empty, measurement invalid
+  }
+
+  // count discharged charge in whole mAh, without dividing
+  if (current < 0) {
+    dischargeRemainder += -current * dt;
+    while (dischargeRemainder >= MAS_PER_MAH) {
+      dischargeRemainder -= MAS_PER_MAH;
+      measured_mAh++;
+      health.throughput_mAh++;
+    }
+  }
+
+  if (health.throughput_mAh >= health.capacity_mAh) {
+    health.throughput_mAh -= health.capacity_mAh;
+    health.cycles++;
+    changed = true;
+  }
+  else if (health.throughput_mAh - savedThroughput >= HEALTH_SAVE_THROUGHPUT_MAH) {
+    changed = true;
+  }
+
+  // empty after a discharge from full: one capacity measurement
+  if (measuring && bms.getMinCellVoltage() <= emptyCellVoltage) {
+    measuring = false;
+    int delta = ((int)measured_mAh - (int)health.capacity_mAh) / 4;    // blend 1/4 of the new value
+    if (abs(delta) >= HEALTH_MIN_CHANGE_MAH) {
+      health.capacity_mAh += delta;
+      changed = true;
+    }
+    logEvent(LOG_HEALTH_CAPACITY, measured_mAh, health.capacity_mAh);
+  }
+
+  if (changed) {
+    healthSave();
+  }
+}
+
+uint16_t healthCapacity() {
+  return health.capacity_mAh;
+}
+
+uint16_t healthCycles() {
+  return health.cycles;
+}
+
+uint16_t healthSOH() {
+  if (designCapacity == 0) {
+    return 0;
+  }
+  return (unsigned long)health.capacity_mAh * 1000 / designCapacity;
+}
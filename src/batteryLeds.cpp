@@ -0,0 +1,118 @@
+#include "batteryLeds.h"
+
+// Snapshot of the BMS state, written every 250ms, read by the effects
+typedef struct {
+    uint8_t         numCells;
+    int             cellVoltages[MAX_NUMBER_OF_CELLS];  // mV
+    int             minCellVoltage;                     // mV
+    long            current;                            // mA, > 0 while charging
+    int             errorStatus;
+    unsigned int    balancingStatus;
+} battery_view;
+
+battery_view batteryView;
+
+// State of charge range, scale avoids a division per frame
+int socEmpty_mV = 3000;
+unsigned long socScale = (1UL << 16) / (4200 - 3000);
+
+// 16 colors from red (empty / imbalanced) to green (full / balanced)
+#define LEVEL_COLORS 16
+HSL_PALETTE(levelColors, LEVEL_COLORS, 0, 8, 100, 50);
+
+/*
+ * Keyframe tracks: brightness levels at 9 evenly spaced points of a 256 frame
+ * cycle (every 32 frames), linearly interpolated in between with a shift
+ */
+typedef uint8_t keyframe_track[9];
+
+const keyframe_track pulseTrack = { 64, 128, 192, 255, 255, 192, 128, 64, 64 };
+const keyframe_track faultTrack = { 255, 255, 0, 0, 255, 255, 0, 0, 255 };
+
+uint8_t keyframeLevel(const keyframe_track track, uint8_t t) {
+    uint8_t key = t >> 5;
+    int from = track[key];
+    int to = track[key + 1];
+    return from + (((to - from) * (t & 31)) >> 5);
+}
+
+void batteryLedsSetRange(int empty_mV, int full_mV) {
+    if (full_mV <= empty_mV) {
+        return;
+    }
+    socEmpty_mV = empty_mV;
+    socScale = (1UL << 16) / (full_mV - empty_mV);
+}
+
+void batteryLedsUpdate(bq769x0 &bms) {
+    batteryView.numCells = bms.getNumberOfCells();
+    for (uint8_t i = 0; i < batteryView.numCells; i++) {
+        batteryView.cellVoltages[i] = bms.getCellVoltage(i);
+    }
+    batteryView.minCellVoltage = bms.getMinCellVoltage();
+    batteryView.current = bms.getBatteryCurrent();
+    batteryView.errorStatus = bms.getErrorStatus();
+    batteryView.balancingStatus = bms.getBalancingStatus();
+}
+
+// State of charge of the lowest cell, 0 to 65535
+unsigned long stateOfCharge() {
+    long delta = batteryView.minCellVoltage - socEmpty_mV;
+    if (delta <= 0) {
+        return 0;
+    }
+    unsigned long soc = delta * socScale;
+    return (soc > 0xFFFF) ? 0xFFFF : soc;
+}
+
+void batteryLevelEffect(uint8_t output, uint8_t length, unsigned long frame) {
+    // fault layer replaces everything else
+    if (batteryView.errorStatus != 0) {
+        int red = rgbScale(0xFF0000, keyframeLevel(faultTrack, frame * 8));
+        for (uint8_t i = 0; i < length; i++) {
+            rgbSetStripPixel(output, i, red);
+        }
+        return;
+    }
+
+    unsigned long soc = stateOfCharge();
+    uint8_t lit = (soc * length) >> 16;
+    int color = levelColors[(soc * LEVEL_COLORS) >> 16];
+
+    for (uint8_t i = 0; i < length; i++) {
+        if (i < lit) {
+            rgbSetStripPixel(output, i, color);
+        }
+        else if (i == lit && batteryView.current > 0) {
+            // charging layer, leading pixel breathes
+            rgbSetStripPixel(output, i, rgbScale(color, keyframeLevel(pulseTrack, frame * 2)));
+        }
+        else {
+            rgbSetStripPixel(output, i, 0);
+        }
+    }
+}
+
+void cellHeatmapEffect(uint8_t output, uint8_t length, unsigned long frame) {
+    uint8_t pulse = keyframeLevel(pulseTrack, frame * 4);
+
+    for (uint8_t i = 0; i < length; i++) {
+        if (i >= batteryView.numCells) {
+            rgbSetStripPixel(output, i, 0);
+            continue;
+        }
+        // 4 mV per palette step, 60 mV and above is red
+        int diff = (batteryView.cellVoltages[i] - batteryView.minCellVoltage) >> 2;
+        if (diff < 0) {
+            diff = 0;
+        }
+        if (diff > LEVEL_COLORS - 1) {
+            diff = LEVEL_COLORS - 1;
+        }
+        int color = levelColors[LEVEL_COLORS - 1 - diff];
+        if (batteryView.balancingStatus & (1 << i)) {
+            color = rgbScale(color, pulse);
+        }
+        rgbSetStripPixel(output, i, color);
+    }
+}
@@ -0,0 +1,43 @@
+#include <EEPROM.h>
+#include <FastCRC.h>
+
+#include "bmsConfig.h"
+#include "eepromLayout.h"
+
+static_assert(sizeof(config_record) <= EEPROM_CONFIG_END - EEPROM_CONFIG_START,
+  "config record does not fit into its region in eepromLayout.h");
+
+static FastCRC8 configCRC;
+
+const bq769x0_config configDefault = {
+  9,                // shunt resistor mOhm
+  -20, 45,          // discharge temperature range °C
+  0, 45,            // charge temperature range °C
+  100,              // idle current mA
+  14000, 200,       // short circuit mA, us
+  8000, 200,        // charge overcurrent mA, ms
+  8000, 320,        // discharge overcurrent mA, ms
+  3000, 4,          // cell undervoltage mV, s
+  4400, 2,          // cell overvoltage mV, s
+  0, 4200, 20       // balancing idle time min, min cell mV, max difference mV
+};
+
+bq769x0_config configLoad() {
+  config_record rec;
+  EEPROM.get(EEPROM_CONFIG_START, rec);
+
+  if (rec.version == CONFIG_RECORD_VERSION &&
+    rec.crc == configCRC.smbus((const uint8_t *)&rec, sizeof(config_record) - 1))
+  {
+    return rec.config;
+  }
+  return configDefault;
+}
+
+void configSave(const bq769x0_config &config) {
+  config_record rec;
+  rec.version = CONFIG_RECORD_VERSION;
+  rec.config = config;
+  rec.crc = configCRC.smbus((const uint8_t *)&rec, sizeof(config_record) - 1);
+  EEPROM.put(EEPROM_CONFIG_START, rec);
+}
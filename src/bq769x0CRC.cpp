@@ -29,9 +29,17 @@
 
 #include "bq769x0CRC.h"
 #include "registers.h"
+#include "logRing.h"
+#include "i2cTrace.h"
 
-// for the ISR to know the bq769x0 instance
-bq769x0* bq769x0::instancePointer = 0;
+// for the ISRs to know the bq769x0 instances, one slot per begin()
+bq769x0* bq769x0::instances[BQ769X0_MAX_INSTANCES];
+
+// one ISR per slot, attachInterrupt() takes no argument
+void (* const bq769x0::alertISRs[BQ769X0_MAX_INSTANCES])(void) = {
+  bq769x0::alertISR<0>, bq769x0::alertISR<1>, bq769x0::alertISR<2>, bq769x0::alertISR<3>
+};
+static_assert(BQ769X0_MAX_INSTANCES == 4, "update alertISRs[] to match BQ769X0_MAX_INSTANCES");
 
 // CRC
 FastCRC8 CRC8;
@@ -99,13 +107,16 @@ bq769x0::bq769x0(uint8_t numCells, byte bqType, int bqI2CAddress)
 
 int bq769x0::begin(i2c_t3 *theWire, byte alertPin, byte bootPin)
 {
+  TRACE_CALLER(TRACE_BEGIN);
   //Wire.begin();        // join I2C bus
   _wire = theWire;
 
   // initialize variables
   for (byte i = 0; i < numberOfCells; i++) {
     cellVoltages[i] = 0;
+    irSumIV[i] = 0;
   }
+  invalidateBalancingRegisters();   // CELLBAL contents unknown until written
   
   // Boot IC if pin is defined (else: manual boot via push button has to be 
   // done before calling this method)
@@ -118,17 +129,41 @@ int bq769x0::begin(i2c_t3 *theWire, byte alertPin, byte bootPin)
     delay(10);  // wait for device to boot up completely (datasheet: max. 10 ms)
   }
  
+  // start slow, the link manager steps the clock up on a clean link
+  _wire->setClock(linkStats.clock);
+
   // test communication
   writeRegister(CC_CFG, 0x19);       // should be set to 0x19 according to datasheet
   if (readRegister(CC_CFG) == 0x19)
   {
     // initial settings for bq769x0
-    writeRegister(SYS_CTRL1, B00010000);  // switch die temp (no thermistor) and ADC on
-    writeRegister(SYS_CTRL2, B01000000);  // switch CC_EN on
+    // ADC on, TS inputs read the die temperature unless thermistors are fitted
+    if (!writeRegister(SYS_CTRL1, thermistorsFitted ? B00011000 : B00010000) ||
+      !writeRegister(SYS_CTRL2, B01000000))  // switch CC_EN on
+    {
+      return 1;
+    }
 
-    // attach ALERT interrupt to this instance
-    instancePointer = this;
-    attachInterrupt(digitalPinToInterrupt(alertPin), bq769x0::alertISR, RISING);
+    // attach ALERT interrupt to this instance, once per pin if several
+    // ICs share one ALERT line
+    byte slot = BQ769X0_MAX_INSTANCES;
+    bool pinAttached = false;
+    for (byte i = 0; i < BQ769X0_MAX_INSTANCES; i++) {
+      if (instances[i] == this || (instances[i] == 0 && slot == BQ769X0_MAX_INSTANCES)) {
+        slot = i;
+      }
+      else if (instances[i] != 0 && instances[i]->alertPin == alertPin) {
+        pinAttached = true;
+      }
+    }
+    if (slot == BQ769X0_MAX_INSTANCES) {
+      return 1;   // no free slot
+    }
+    this->alertPin = alertPin;
+    instances[slot] = this;
+    if (!pinAttached) {
+      attachInterrupt(digitalPinToInterrupt(alertPin), alertISRs[slot], RISING);
+    }
 
     // get ADC offset and gain
     adcOffset = (signed int) readRegister(ADCOFFSET);  // convert from 2's complement
@@ -143,103 +178,122 @@ int bq769x0::begin(i2c_t3 *theWire, byte alertPin, byte bootPin)
   }
 }
 
+//----------------------------------------------------------------------------
+// Recovery settings per SYS_STAT fault bit:
+// OCD, SCD, OV, UV, OVRD_ALERT, DEVICE_XREADY
+
+// delay before the first attempt to clear the fault (ms)
+const unsigned long faultRetryDelay_ms[NUM_FAULTS] = { 60000, 60000, 1000, 1000, 10000, 3000 };
+// the delay doubles after each failed attempt, up to 2^faultMaxBackoff times
+const uint8_t faultMaxBackoff[NUM_FAULTS] = { 3, 3, 0, 0, 2, 2 };
+const uint8_t faultClearEvent[NUM_FAULTS] = { LOG_BMS_OCD_CLEAR, LOG_BMS_SCD_CLEAR,
+  LOG_BMS_OV_CLEAR, LOG_BMS_UV_CLEAR, LOG_BMS_ALERT_CLEAR, LOG_BMS_XR_CLEAR };
+
 //----------------------------------------------------------------------------
 // Fast function to check whether BMS has an error
 // (returns 0 if everything is OK)
+//
+// Each fault has its own recovery state: an absolute deadline for the next
+// attempt to clear it and a retry count for the backoff. The count is kept
+// until the fault has stayed clear for its base retry delay. Cell voltages are
+// read at most once per call, shared by the UV and OV checks.
 
 int bq769x0::checkStatus()
 {
+  TRACE_CALLER(TRACE_STATUS);
   if (alertInterruptFlag == false && errorStatus == 0) {
-    return 0;
+    return softwareErrorStatus;
   }
   else {
     
     regSYS_STAT_t sys_stat;
-    sys_stat.regByte = readRegister(SYS_STAT);
+    int stat = readRegister(SYS_STAT);
+    if (stat < 0) {
+      return errorStatus | softwareErrorStatus;   // try again next time
+    }
+    sys_stat.regByte = stat;
 
     if (sys_stat.bits.CC_READY == 1) {
       updateCurrent(true);  // automatically clears CC ready flag	
     }
-    
-    // Serious error occured
-    if (sys_stat.regByte & B00111111)
+
+    unsigned long now = millis();
+    byte faults = sys_stat.regByte & STAT_FLAGS;
+    byte clearFlags = 0;
+    bool voltagesUpdated = false;
+
+    for (byte fault = 0; fault < NUM_FAULTS; fault++)
     {
-      if (alertInterruptFlag == true) {
-        secSinceErrorCounter = 0;
+      byte flag = 1 << fault;
+
+      if (!(faults & flag)) {
+        if ((faultActive & flag) && !(faultGone & flag)) {
+          faultGone |= flag;
+          faultGoneTimestamp[fault] = now;
+        }
+        continue;
       }
-      errorStatus = sys_stat.regByte;
-      
-      int secSinceInterrupt = (millis() - interruptTimestamp) / 1000;
-      
-      // check for overrun of millis() or very slow running program
-      if (abs(secSinceInterrupt - secSinceErrorCounter) > 2) {
-        secSinceErrorCounter = secSinceInterrupt;
+
+      // A fault that stayed away for its base delay starts over. One that
+      // is back sooner, like an overload re-tripping right after each
+      // clear, keeps its backoff.
+      if ((faultGone & flag) && now - faultGoneTimestamp[fault] >= faultRetryDelay_ms[fault]) {
+        faultActive &= ~flag;
       }
-      
-      // called only once per second
-      if (secSinceInterrupt >= secSinceErrorCounter)
-      {
-        if (sys_stat.regByte & B00100000) { // XR error
-          // datasheet recommendation: try to clear after waiting a few seconds
-          if (secSinceErrorCounter % 3 == 0) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear XR error"));
-            #endif
-            writeRegister(SYS_STAT, B00100000);
-          }
-        }
-        if (sys_stat.regByte & B00010000) { // Alert error
-          if (secSinceErrorCounter % 10 == 0) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear Alert error"));
-            #endif
-            writeRegister(SYS_STAT, B00010000);
-          }
-        }
-        if (sys_stat.regByte & B00001000) { // UV error
-          updateVoltages();
-          if (cellVoltages[idCellMinVoltage] > minCellVoltage) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear UV error"));
-            #endif
-            writeRegister(SYS_STAT, B00001000);
-          }
+      faultGone &= ~flag;
+
+      // new fault: schedule the first attempt
+      if (!(faultActive & flag)) {
+        if (flag == STAT_DEVICE_XREADY) {
+          invalidateBalancingRegisters();   // internal fault, registers may have been reset
         }
-        if (sys_stat.regByte & B00000100) { // OV error
+        faultActive |= flag;
+        faultRetries[fault] = 0;
+        faultDeadline[fault] = now + faultRetryDelay_ms[fault];
+        continue;
+      }
+
+      if ((long)(now - faultDeadline[fault]) < 0) {
+        continue;
+      }
+
+      bool clear = true;
+      if (flag & (STAT_UV | STAT_OV)) {
+        if (!voltagesUpdated) {
           updateVoltages();
-          if (cellVoltages[idCellMaxVoltage] < maxCellVoltage) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear OV error"));
-            #endif
-            writeRegister(SYS_STAT, B00000100);
-          }
+          voltagesUpdated = true;
         }
-        if (sys_stat.regByte & B00000010) { // SCD
-          if (secSinceErrorCounter % 60 == 0) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear SCD error"));
-            #endif
-            writeRegister(SYS_STAT, B00000010);
-          }
-        }
-        if (sys_stat.regByte & B00000001) { // OCD
-          if (secSinceErrorCounter % 60 == 0) {
-            #if BQ769X0_DEBUG
-            Serial.println(F("Attempting to clear OCD error"));
-            #endif
-            writeRegister(SYS_STAT, B00000001);
-            enableDischarging();
-          }
+        clear = (flag == STAT_UV) ?
+          cellVoltages[idCellMinVoltage] > minCellVoltage :
+          cellVoltages[idCellMaxVoltage] < maxCellVoltage;
+      }
+
+      if (clear) {
+        clearFlags |= flag;
+        logEvent(faultClearEvent[fault], sys_stat.regByte,
+          (flag == STAT_UV) ? cellVoltages[idCellMinVoltage] :
+          (flag == STAT_OV) ? cellVoltages[idCellMaxVoltage] : faultRetries[fault]);
+        if (faultRetries[fault] < faultMaxBackoff[fault]) {
+          faultRetries[fault]++;
         }
-        
-        secSinceErrorCounter++;
       }
+      // if the fault is still there after clearing, the next try comes later
+      faultDeadline[fault] = now + (faultRetryDelay_ms[fault] << faultRetries[fault]);
     }
-    else {
-      errorStatus = 0;
+
+    // all clear attempts of this pass in one write
+    if (clearFlags) {
+      writeRegister(SYS_STAT, clearFlags);
     }
-    
-    return errorStatus;
+
+    // keep reporting cleared faults until the next pass confirms they are gone
+    errorStatus = faults;
+
+    if (clearFlags & STAT_OCD) {
+      enableDischarging();
+    }
+
+    return errorStatus | softwareErrorStatus;
 
   }
 
@@ -250,9 +304,62 @@ int bq769x0::checkStatus()
 
 void bq769x0::update()
 {
+  beginUpdate();
+  finishUpdate();
+}
+
+//----------------------------------------------------------------------------
+// update() in two halves: beginUpdate() starts the cell voltage block read
+// without waiting for it, finishUpdate() completes it. bq769x0Poller uses
+// this to run the block reads of ICs on different buses at the same time.
+
+void bq769x0::beginUpdate()
+{
+  TRACE_TRANSFER(TRACE_MARK, 0, 0, 0);
   updateCurrent(false);  // will only read new current value if alert was triggered
   delayMicroseconds(100);
-  updateVoltages();
+  requestCellVoltages();
+}
+
+void bq769x0::finishUpdate()
+{
+  readCellVoltages();
+  updatePackVoltage();
+
+  // voltages and current of this pass belong together
+  if (currentUpdated) {
+    currentUpdated = false;
+    updateResistanceEstimate();
+  }
+
+  // the bq769x0 converts the TS inputs only every 2 s, no need to read faster
+  bool temperaturesUpdated = false;
+  if (millis() - temperatureTimestamp >= TEMP_SAMPLE_INTERVAL_MS) {
+    temperatureTimestamp = millis();
+    updateTemperatures();
+    checkTemperatureLimits();
+    temperaturesUpdated = true;
+  }
+
+  updateWarnings(temperaturesUpdated);
+
+  // FETs switched off by a software trip come back once no trip blocks
+  // them, retried each update as enable*() refuse while another fault is
+  // active. Never while the protection config is unverified.
+  if (protectionVerified()) {
+    if ((occRestoreCharging || tempRestoreCharging) &&
+      !(softwareErrorStatus & STAT_SW_CHG_FLAGS) && enableCharging())
+    {
+      occRestoreCharging = false;
+      tempRestoreCharging = false;
+    }
+    if (tempRestoreDischarging && !(softwareErrorStatus & STAT_SW_DSG_FLAGS) &&
+      enableDischarging())
+    {
+      tempRestoreDischarging = false;
+    }
+  }
+
   updateBalancingSwitches();
 }
 
@@ -268,17 +375,24 @@ void bq769x0::shutdown()
 
 //----------------------------------------------------------------------------
 
+// Faults that only concern discharging (STAT_SW_DSG_FLAGS) do not block
+// charging and vice versa
+
 bool bq769x0::enableCharging()
 {
-  if (checkStatus() == 0 &&
+  TRACE_CALLER(TRACE_FETS);
+  if ((checkStatus() & ~STAT_SW_DSG_FLAGS) == 0 &&
     cellVoltages[idCellMaxVoltage] < maxCellVoltage)
   {
-    byte sys_ctrl2;
+    int sys_ctrl2;
     sys_ctrl2 = readRegister(SYS_CTRL2);
-    writeRegister(SYS_CTRL2, sys_ctrl2 | B00000001);  // switch CHG on
-    #if BQ769X0_DEBUG
-    Serial.println("Enabling CHG FET");
-    #endif
+    if (sys_ctrl2 < 0) {
+      return false;
+    }
+    if (!writeRegister(SYS_CTRL2, sys_ctrl2 | B00000001)) {  // switch CHG on
+      return false;
+    }
+    logEvent(LOG_BMS_CHG_ON, cellVoltages[idCellMaxVoltage]);
     return true;
   }
   else {
@@ -288,16 +402,53 @@ bool bq769x0::enableCharging()
 
 //----------------------------------------------------------------------------
 
+bool bq769x0::disableCharging()
+{
+  TRACE_CALLER(TRACE_FETS);
+  occRestoreCharging = false;   // switched off on purpose, not by a trip
+  tempRestoreCharging = false;
+  int sys_ctrl2;
+  sys_ctrl2 = readRegister(SYS_CTRL2);
+  if (sys_ctrl2 < 0) {
+    sys_ctrl2 = B01000000;  // unknown, keep CC_EN and switch DSG off as well
+  }
+  return writeRegister(SYS_CTRL2, sys_ctrl2 & ~B00000001);  // switch CHG off
+}
+
+//----------------------------------------------------------------------------
+// Switches off the FETs in mask (FET_CHG, FET_DSG) for a software trip and
+// returns those of them that were on, so the trip can restore them. Unlike
+// disable*() it keeps the restore flags of other trips.
+
+byte bq769x0::tripFets(byte mask)
+{
+  TRACE_CALLER(TRACE_FETS);
+  int sys_ctrl2;
+  sys_ctrl2 = readRegister(SYS_CTRL2);
+  if (sys_ctrl2 < 0) {
+    // unknown, keep CC_EN and switch both off, nothing to restore
+    writeRegister(SYS_CTRL2, B01000000);
+    return 0;
+  }
+  writeRegister(SYS_CTRL2, sys_ctrl2 & ~mask);
+  return sys_ctrl2 & mask;
+}
+
+//----------------------------------------------------------------------------
+
 bool bq769x0::enableDischarging()
 {
-  if (checkStatus() == 0 )
+  TRACE_CALLER(TRACE_FETS);
+  if ((checkStatus() & ~STAT_SW_CHG_FLAGS) == 0 )
     // &&
     // cellVoltages[idCellMinVoltage] > minCellVoltage)
   {
-    byte sys_ctrl2;
+    int sys_ctrl2;
     sys_ctrl2 = readRegister(SYS_CTRL2);
-    writeRegister(SYS_CTRL2, sys_ctrl2 | B00000010);  // switch DSG on
-    return true;
+    if (sys_ctrl2 < 0) {
+      return false;
+    }
+    return writeRegister(SYS_CTRL2, sys_ctrl2 | B00000010);  // switch DSG on
   }
   else {
     return false;
@@ -306,6 +457,20 @@ bool bq769x0::enableDischarging()
 
 //----------------------------------------------------------------------------
 
+bool bq769x0::disableDischarging()
+{
+  TRACE_CALLER(TRACE_FETS);
+  tempRestoreDischarging = false;   // switched off on purpose, not by a trip
+  int sys_ctrl2;
+  sys_ctrl2 = readRegister(SYS_CTRL2);
+  if (sys_ctrl2 < 0) {
+    sys_ctrl2 = B01000000;  // unknown, keep CC_EN and switch CHG off as well
+  }
+  return writeRegister(SYS_CTRL2, sys_ctrl2 & ~B00000010);  // switch DSG off
+}
+
+//----------------------------------------------------------------------------
+
 void bq769x0::enableAutoBalancing(void)
 {
   autoBalancingEnabled = true;
@@ -328,7 +493,6 @@ void bq769x0::setBalancingThresholds(int idleTime_min, int absVoltage_mV, byte v
 byte bq769x0::updateBalancingSwitches(void)
 {
   long idleSeconds = (millis() - idleTimestamp) / 1000;
-  byte numberOfSections = numberOfCells/5;
   
   // check for millis() overflow
   if (idleSeconds < 0) {
@@ -343,46 +507,120 @@ byte bq769x0::updateBalancingSwitches(void)
     (cellVoltages[idCellMaxVoltage] - cellVoltages[idCellMinVoltage]) > balancingMaxVoltageDifference_mV)
   {
     balancingActive = true;
-    
-    regCELLBAL_t cellbal;
-    byte balancingFlags;
-    byte balancingFlagsTarget;
-    
-    for (int section = 0; section < numberOfSections; section++)
-    {
-      balancingFlags = 0;
-      for (int i = 0; i < 5; i++)
-      {
-        if ((cellVoltages[section*5 + i] - cellVoltages[idCellMinVoltage]) > balancingMaxVoltageDifference_mV) {
-          
-          // try to enable balancing of current cell
-          balancingFlagsTarget = balancingFlags | (1 << i);
-
-          // check if attempting to balance adjacent cells
-          bool adjacentCellCollision = 
-            ((balancingFlagsTarget << 1) & balancingFlags) ||
-            ((balancingFlags << 1) & balancingFlagsTarget);
-            
-          if (adjacentCellCollision == false) {
-            balancingFlags = balancingFlagsTarget;
-          }          
-        }
-      }
-      
-      // set balancing register for this section
-      writeRegister(CELLBAL1+section, balancingFlags);
+
+    // every BALANCING_SWAP_INTERVAL_MS alternate between the best set and
+    // the best set that leaves out the cells balanced before, so cells next
+    // to a high cell get their turn as well
+    if ((long)(millis() - balancingSwapTimestamp) >= BALANCING_SWAP_INTERVAL_MS) {
+      balancingSwapTimestamp = millis();
+      balancingAlternate = !balancingAlternate;
+      balancingPrevious = balancingStatus;
     }
+
+    unsigned int flags = 0;
+    if (balancingAlternate) {
+      flags = selectBalancingCells(balancingPrevious);
+    }
+    if (flags == 0) {
+      flags = selectBalancingCells(0);
+    }
+    writeBalancingRegisters(flags);
   }
   else if (balancingActive == true)
   {  
     // clear all CELLBAL registers
-    for (int section = 0; section < numberOfSections; section++)
-    {
-      writeRegister(CELLBAL1+section, 0x0);
-    }
-    
+    writeBalancingRegisters(0);
     balancingActive = false;
   }
+
+  byte count = 0;
+  for (unsigned int flags = balancingStatus; flags != 0; flags &= flags - 1) {
+    count++;
+  }
+  return count;   // number of cells being balanced
+}
+
+//----------------------------------------------------------------------------
+// Picks the cells to balance. Adjacent cells must not be balanced at the same
+// time, also across section boundaries, so this is a maximum weight
+// independent set on the chain of cells. Each cell more than
+// balancingMaxVoltageDifference_mV above the lowest cell weighs 2^rank, rank
+// being the number of such cells with less excess. A cell then outweighs all
+// lower cells together, so the highest cell is always bled, then the highest
+// one that still fits, and so on. O(cells^2) for the ranks, no division.
+
+unsigned int bq769x0::selectBalancingCells(unsigned int excludedCells)
+{
+  long best[MAX_NUMBER_OF_CELLS + 1];   // best[i]: best total using cells 0..i-1
+  int excess[MAX_NUMBER_OF_CELLS];
+  long weight[MAX_NUMBER_OF_CELLS];
+
+  for (int i = 0; i < numberOfCells; i++)
+  {
+    excess[i] = cellVoltages[i] - cellVoltages[idCellMinVoltage];
+    if (excess[i] <= balancingMaxVoltageDifference_mV || (excludedCells & (1 << i))) {
+      excess[i] = 0;
+    }
+  }
+
+  best[0] = 0;
+  for (int i = 0; i < numberOfCells; i++)
+  {
+    weight[i] = 0;
+    if (excess[i] > 0) {
+      byte rank = 0;
+      for (int j = 0; j < numberOfCells; j++) {
+        if (excess[j] > 0 && excess[j] < excess[i]) {
+          rank++;
+        }
+      }
+      weight[i] = 1L << rank;
+    }
+
+    long take = weight[i] + ((i >= 1) ? best[i-1] : 0);
+    best[i+1] = (weight[i] > 0 && take > best[i]) ? take : best[i];
+  }
+
+  // walk back through the table to recover the chosen cells
+  unsigned int flags = 0;
+  int i = numberOfCells;
+  while (i > 0) {
+    if (best[i] != best[i-1]) {
+      flags |= 1 << (i-1);
+      i -= 2;
+    }
+    else {
+      i--;
+    }
+  }
+  return flags;
+}
+
+//----------------------------------------------------------------------------
+// writes CELLBAL1..3, skipping registers that already hold the right value.
+// A failed write leaves the register unknown, so it is written again next time.
+
+void bq769x0::writeBalancingRegisters(unsigned int flags)
+{
+  TRACE_CALLER(TRACE_BALANCING);
+  byte numberOfSections = (numberOfCells + 4) / 5;
+
+  for (int section = 0; section < numberOfSections; section++)
+  {
+    byte balancingFlags = (flags >> section*5) & 0x1F;
+    if (balancingFlags != cellbalRegisters[section]) {
+      cellbalRegisters[section] = writeRegister(CELLBAL1+section, balancingFlags) ?
+        balancingFlags : 0xFF;
+    }
+  }
+  balancingStatus = flags;
+}
+
+void bq769x0::invalidateBalancingRegisters()
+{
+  for (byte section = 0; section < 3; section++) {
+    cellbalRegisters[section] = 0xFF;
+  }
 }
 
 void bq769x0::setShuntResistorValue(int res_mOhm)
@@ -395,6 +633,20 @@ void bq769x0::setThermistorBetaValue(int beta_K)
   thermistorBetaValue = beta_K;
 }
 
+// Selects what the TS inputs measure. Without thermistors the bq769x0
+// converts its die temperature instead. After switching, the first new
+// conversion takes up to 2 s, so the old readings are dropped until then.
+
+void bq769x0::setThermistors(bool fitted)
+{
+  thermistorsFitted = fitted;
+  if (_wire != 0) {
+    writeRegister(SYS_CTRL1, fitted ? B00011000 : B00010000);
+    temperaturesValid = false;
+    temperatureTimestamp = millis();
+  }
+}
+
 void bq769x0::setTemperatureLimits(int minDischarge_degC, int maxDischarge_degC, 
   int minCharge_degC, int maxCharge_degC)
 {
@@ -415,7 +667,9 @@ void bq769x0::setIdleCurrentThreshold(int current_mA)
 
 long bq769x0::setShortCircuitProtection(long current_mA, int delay_us)
 {
+  TRACE_CALLER(TRACE_CONFIG);
   regPROTECT1_t protect1;
+  protect1.regByte = protectImage[0];
   
   // only RSNS = 1 considered
   protect1.bits.RSNS = 1;
@@ -436,7 +690,10 @@ long bq769x0::setShortCircuitProtection(long current_mA, int delay_us)
     }
   }
   
-  writeRegister(PROTECT1, protect1.regByte);
+  protectImage[0] = protect1.regByte;
+  if (!protectBatch) {
+    writeProtectRegisters();
+  }
   
   // returns the actual current threshold value
   return (long)SCD_threshold_setting[protect1.bits.SCD_THRESH] * 1000 / 
@@ -445,16 +702,37 @@ long bq769x0::setShortCircuitProtection(long current_mA, int delay_us)
 
 //----------------------------------------------------------------------------
 
+// The bq769x0 has no charge overcurrent protection, so it is done in
+// software on every coulomb counter sample (see checkChargeOvercurrent).
+// A current_mA of 0 disables it.
+
 long bq769x0::setOvercurrentChargeProtection(long current_mA, int delay_ms)
 {
-  // ToDo: Software protection for charge overcurrent
+  int samples = (delay_ms + CC_SAMPLE_PERIOD_MS - 1) / CC_SAMPLE_PERIOD_MS;
+  if (samples < 1) {
+    samples = 1;
+  }
+  if (samples > OCC_MAX_WINDOW) {
+    samples = OCC_MAX_WINDOW;
+  }
+
+  occThreshold_mA = current_mA;
+  occWindowLength = samples;
+  occWindowCount = 0;
+  occWindowIndex = 0;
+  occWindowSum = 0;
+
+  // returns the actual current threshold value
+  return occThreshold_mA;
 }
 
 //----------------------------------------------------------------------------
 
 long bq769x0::setOvercurrentDischargeProtection(long current_mA, int delay_ms)
 {
+  TRACE_CALLER(TRACE_CONFIG);
   regPROTECT2_t protect2;
+  protect2.regByte = protectImage[1];
   long tempValue = (current_mA * shuntResistorValue_mOhm) / 1000;
 
   // Remark: RSNS must be set to 1 in PROTECT1 register
@@ -475,7 +753,10 @@ long bq769x0::setOvercurrentDischargeProtection(long current_mA, int delay_ms)
     }
   }
   
-  writeRegister(PROTECT2, protect2.regByte);
+  protectImage[1] = protect2.regByte;
+  if (!protectBatch) {
+    writeProtectRegisters();
+  }
  
   // returns the actual current threshold value
   return (long)OCD_threshold_setting[protect2.bits.OCD_THRESH] * 1000 / 
@@ -485,18 +766,24 @@ long bq769x0::setOvercurrentDischargeProtection(long current_mA, int delay_ms)
 
 //----------------------------------------------------------------------------
 
+// UV_TRIP and OV_TRIP hold bits 11..4 of the 14 bit ADC value, bits 13..12
+// are fixed to 01 (UV) and 10 (OV).
+
 int bq769x0::setCellUndervoltageProtection(int voltage_mV, int delay_s)
 {
+  TRACE_CALLER(TRACE_CONFIG);
   regPROTECT3_t protect3;
   byte uv_trip = 0;
   
   minCellVoltage = voltage_mV;
   
-  protect3.regByte = readRegister(PROTECT3);
+  protect3.regByte = protectImage[2];   // shared with OV_DELAY
   
-  uv_trip = ((long)((voltage_mV - adcOffset) / (adcGain*1000)) >> 4) & 0x00FF;
-  uv_trip += 1;   // always round up for lower cell voltage
-  writeRegister(UV_TRIP, uv_trip);
+  uv_trip = (((long)(voltage_mV - adcOffset) * 1000 / adcGain) >> 4) & 0x00FF;
+  if (uv_trip < 0xFF) {
+    uv_trip += 1;   // always round up for lower cell voltage
+  }
+  protectImage[4] = uv_trip;
   
   protect3.bits.UV_DELAY = 0;
   for (int i = sizeof(UV_delay_setting)/sizeof(UV_delay_setting[0])-1; i > 0; i--) {
@@ -506,7 +793,10 @@ int bq769x0::setCellUndervoltageProtection(int voltage_mV, int delay_s)
     }
   }
   
-  writeRegister(PROTECT3, protect3.regByte);
+  protectImage[2] = protect3.regByte;
+  if (!protectBatch) {
+    writeProtectRegisters();
+  }
   
   // returns the actual current threshold value
   return ((long)1 << 12 | uv_trip << 4) * adcGain / 1000 + adcOffset;
@@ -516,15 +806,16 @@ int bq769x0::setCellUndervoltageProtection(int voltage_mV, int delay_s)
 
 int bq769x0::setCellOvervoltageProtection(int voltage_mV, int delay_s)
 {
+  TRACE_CALLER(TRACE_CONFIG);
   regPROTECT3_t protect3;
   byte ov_trip = 0;
 
   maxCellVoltage = voltage_mV;
   
-  protect3.regByte = readRegister(PROTECT3);
+  protect3.regByte = protectImage[2];   // shared with UV_DELAY
   
-  ov_trip = ((long)((voltage_mV - adcOffset) / (adcGain*1000)) >> 4) & 0x00FF;
-  writeRegister(OV_TRIP, ov_trip);
+  ov_trip = (((long)(voltage_mV - adcOffset) * 1000 / adcGain) >> 4) & 0x00FF;
+  protectImage[3] = ov_trip;
     
   protect3.bits.OV_DELAY = 0;
   for (int i = sizeof(OV_delay_setting)/sizeof(OV_delay_setting[0])-1; i > 0; i--) {
@@ -534,12 +825,122 @@ int bq769x0::setCellOvervoltageProtection(int voltage_mV, int delay_s)
     }
   }
   
-  writeRegister(PROTECT3, protect3.regByte);
+  protectImage[2] = protect3.regByte;
+  if (!protectBatch) {
+    writeProtectRegisters();
+  }
  
   // returns the actual current threshold value
   return (((long)1 << 13 | ov_trip << 4) * adcGain + (adcOffset*1000))/1000;
 }
 
+//----------------------------------------------------------------------------
+// Rejects configurations that would leave the pack unprotected or cannot
+// be encoded
+
+bool bq769x0::configValid(const bq769x0_config &config)
+{
+  return config.shuntResistor_mOhm > 0 &&
+    config.minDischargeTemp_degC < config.maxDischargeTemp_degC &&
+    config.minChargeTemp_degC < config.maxChargeTemp_degC &&
+    config.shortCircuitCurrent_mA > 0 &&
+    config.overcurrentDischarge_mA > 0 &&
+    config.overcurrentDischarge_mA <= config.shortCircuitCurrent_mA &&
+    config.cellUndervoltage_mV >= 1600 &&      // lowest UV_TRIP
+    config.cellOvervoltage_mV <= 4700 &&       // highest OV_TRIP
+    config.cellUndervoltage_mV < config.cellOvervoltage_mV &&
+    config.balancingMinCell_mV < config.cellOvervoltage_mV;
+}
+
+//----------------------------------------------------------------------------
+// Applies a complete configuration. The setters are called in dependency
+// order (shunt resistor before the current thresholds) with the register
+// writes held back, then PROTECT1..UV_TRIP go out in one burst.
+
+int bq769x0::applyConfig(const bq769x0_config &config)
+{
+  TRACE_CALLER(TRACE_CONFIG);
+  if (!configValid(config)) {
+    return CONFIG_INVALID;
+  }
+
+  protectBatch = true;
+  setShuntResistorValue(config.shuntResistor_mOhm);
+  setTemperatureLimits(config.minDischargeTemp_degC, config.maxDischargeTemp_degC,
+    config.minChargeTemp_degC, config.maxChargeTemp_degC);
+  setIdleCurrentThreshold(config.idleCurrent_mA);
+  setShortCircuitProtection(config.shortCircuitCurrent_mA, config.shortCircuitDelay_us);
+  setOvercurrentChargeProtection(config.overcurrentCharge_mA, config.overcurrentChargeDelay_ms);
+  setOvercurrentDischargeProtection(config.overcurrentDischarge_mA,
+    config.overcurrentDischargeDelay_ms);
+  setCellUndervoltageProtection(config.cellUndervoltage_mV, config.cellUndervoltageDelay_s);
+  setCellOvervoltageProtection(config.cellOvervoltage_mV, config.cellOvervoltageDelay_s);
+  setBalancingThresholds(config.balancingIdleTime_min, config.balancingMinCell_mV,
+    config.balancingMaxDifference_mV);
+  protectBatch = false;
+
+  return writeProtectRegisters() ? CONFIG_OK : CONFIG_VERIFY_FAIL;
+}
+
+//----------------------------------------------------------------------------
+// Reports the settings as they are in effect, i.e. with thresholds and
+// delays rounded to what the registers can hold
+
+bq769x0_config bq769x0::getConfig()
+{
+  bq769x0_config config;
+  regPROTECT1_t protect1;
+  regPROTECT2_t protect2;
+  regPROTECT3_t protect3;
+  protect1.regByte = protectImage[0];
+  protect2.regByte = protectImage[1];
+  protect3.regByte = protectImage[2];
+
+  config.shuntResistor_mOhm = shuntResistorValue_mOhm;
+  config.minDischargeTemp_degC = minCellTempDischarge / 10;
+  config.maxDischargeTemp_degC = maxCellTempDischarge / 10;
+  config.minChargeTemp_degC = minCellTempCharge / 10;
+  config.maxChargeTemp_degC = maxCellTempCharge / 10;
+  config.idleCurrent_mA = idleCurrentThreshold;
+  config.shortCircuitCurrent_mA = (long)SCD_threshold_setting[protect1.bits.SCD_THRESH] * 1000 /
+    shuntResistorValue_mOhm;
+  config.shortCircuitDelay_us = SCD_delay_setting[protect1.bits.SCD_DELAY];
+  config.overcurrentCharge_mA = occThreshold_mA;
+  config.overcurrentChargeDelay_ms = occWindowLength * CC_SAMPLE_PERIOD_MS;
+  config.overcurrentDischarge_mA = (long)OCD_threshold_setting[protect2.bits.OCD_THRESH] * 1000 /
+    shuntResistorValue_mOhm;
+  config.overcurrentDischargeDelay_ms = OCD_delay_setting[protect2.bits.OCD_DELAY];
+  config.cellUndervoltage_mV = ((long)1 << 12 | protectImage[4] << 4) * adcGain / 1000 + adcOffset;
+  config.cellUndervoltageDelay_s = UV_delay_setting[protect3.bits.UV_DELAY];
+  config.cellOvervoltage_mV = (((long)1 << 13 | protectImage[3] << 4) * adcGain + (adcOffset*1000))/1000;
+  config.cellOvervoltageDelay_s = OV_delay_setting[protect3.bits.OV_DELAY];
+  config.balancingIdleTime_min = balancingMinIdleTime_s / 60;
+  config.balancingMinCell_mV = balancingMinCellVoltage_mV;
+  config.balancingMaxDifference_mV = balancingMaxVoltageDifference_mV;
+  return config;
+}
+
+//----------------------------------------------------------------------------
+// Writes protectImage in one burst and reads it back. Single setters use it
+// as well, so every protection change is verified; protectionVerified()
+// tells whether the IC holds what was last set.
+
+bool bq769x0::writeProtectRegisters()
+{
+  uint8_t readback[sizeof(protectImage)];
+
+  protectVerified = writeBlock(PROTECT1, protectImage, sizeof(protectImage)) &&
+    readBlock(PROTECT1, readback, sizeof(protectImage)) &&
+    memcmp(readback, protectImage, sizeof(protectImage)) == 0;
+  logEvent(LOG_BMS_CONFIG, protectVerified, (protectImage[3] << 8) | protectImage[4]);
+  return protectVerified;
+}
+
+bool bq769x0::protectionVerified()
+{
+  return protectVerified;
+}
+
 
 //----------------------------------------------------------------------------
 
@@ -564,6 +965,37 @@ int bq769x0::getMaxCellVoltage()
 
 //----------------------------------------------------------------------------
 
+int bq769x0::getMinCellVoltage()
+{
+  return cellVoltages[idCellMinVoltage];
+}
+
+//----------------------------------------------------------------------------
+
+int bq769x0::getNumberOfCells()
+{
+  return numberOfCells;
+}
+
+//----------------------------------------------------------------------------
+// SYS_STAT error flags of the last checkStatus() call plus the STAT_SW_*
+// software protection flags, 0 if no error
+
+int bq769x0::getErrorStatus()
+{
+  return errorStatus | softwareErrorStatus;
+}
+
+//----------------------------------------------------------------------------
+// bit i set if balancing of cell i+1 is switched on
+
+unsigned int bq769x0::getBalancingStatus()
+{
+  return balancingStatus;
+}
+
+//----------------------------------------------------------------------------
+
 int bq769x0::getCellVoltage(byte idCell)
 {
   return cellVoltages[idCell];
@@ -593,19 +1025,33 @@ float bq769x0::getTemperatureDegF(byte channel)
 
 void bq769x0::updateTemperatures()
 {
+  TRACE_CALLER(TRACE_TEMPERATURES);
   float tmp = 0;
   int adcVal = 0;
   int vtsx = 0;
   unsigned long rts = 0;
+  byte numberOfThermistors = type;  // bq76920: TS1, bq76930: TS1-2, bq76940: TS1-3
+  uint8_t data[2 * MAX_NUMBER_OF_THERMISTORS];
   
-  _wire->beginTransmission(I2CAddress);
-  _wire->write(0x2C);
-  _wire->endTransmission();
-  
-  if (_wire->requestFrom(I2CAddress, 2) == 2)
+  if (!readBlock(TS1_HI_BYTE, data, 2 * numberOfThermistors)) {
+    temperaturesValid = false;    // limits are not enforced on stale values
+    return;
+  }
+
+  for (int i = 0; i < numberOfThermistors; i++)
   {
+    adcVal = (data[2*i] & B00111111) << 8;
+    adcVal |= data[2*i + 1];
+
+    if (!thermistorsFitted) {
+      // die temperature according to bq769x0 datasheet: 1.2 V at 25 °C,
+      // -4.2 mV/°C, 382 uV/LSB
+      long vtsx_uV = adcVal * 382L;
+      temperatures[i] = 250 - (vtsx_uV - DIE_TEMP_V25_UV) / DIE_TEMP_SLOPE_UV;
+      continue;
+    }
+
     // calculate R_thermistor according to bq769x0 datasheet
-    adcVal = ((_wire->read() & B00111111) << 8) | _wire->read();
     vtsx = adcVal * 0.382; // mV
     rts = 10000.0 * vtsx / (3300.0 - vtsx); // Ohm
         
@@ -614,7 +1060,165 @@ void bq769x0::updateTemperatures()
     // - 25°C reference temperature for Beta equation assumed
     tmp = 1.0/(1.0/(273.15+25) + 1.0/thermistorBetaValue*log(rts/10000.0)); // K
     
-    temperatures[0] = (tmp - 273.15) * 10.0;
+    temperatures[i] = (tmp - 273.15) * 10.0;
+  }
+  temperaturesValid = true;
+}
+
+//----------------------------------------------------------------------------
+// Compares a new temperature sample against the limits set with
+// setTemperatureLimits(). A limit trips as soon as it is exceeded and clears
+// once the temperature is TEMP_HYSTERESIS back inside. A FET that was on at
+// the trip is switched on again by finishUpdate().
+
+void bq769x0::checkTemperatureLimits()
+{
+  if (!temperaturesValid) {
+    return;
+  }
+
+  int minTemp = temperatures[0];
+  int maxTemp = temperatures[0];
+  for (int i = 1; i < type; i++) {
+    if (temperatures[i] < minTemp) {
+      minTemp = temperatures[i];
+    }
+    if (temperatures[i] > maxTemp) {
+      maxTemp = temperatures[i];
+    }
+  }
+
+  int previous = softwareErrorStatus;
+
+  updateTemperatureFlag(STAT_SW_UTC, minTemp < minCellTempCharge,
+    minTemp >= minCellTempCharge + TEMP_HYSTERESIS, minTemp);
+  updateTemperatureFlag(STAT_SW_OTC, maxTemp > maxCellTempCharge,
+    maxTemp <= maxCellTempCharge - TEMP_HYSTERESIS, maxTemp);
+  updateTemperatureFlag(STAT_SW_UTD, minTemp < minCellTempDischarge,
+    minTemp >= minCellTempDischarge + TEMP_HYSTERESIS, minTemp);
+  updateTemperatureFlag(STAT_SW_OTD, maxTemp > maxCellTempDischarge,
+    maxTemp <= maxCellTempDischarge - TEMP_HYSTERESIS, maxTemp);
+
+  // only touch the FETs on a trip, a FET already off (by the application
+  // or another trip) is not latched for restore
+  int tripped = softwareErrorStatus & ~previous;
+
+  if ((tripped & (STAT_SW_UTC | STAT_SW_OTC)) && tripFets(FET_CHG)) {
+    tempRestoreCharging = true;
+  }
+  if ((tripped & (STAT_SW_UTD | STAT_SW_OTD)) && tripFets(FET_DSG)) {
+    tempRestoreDischarging = true;
+  }
+}
+
+void bq769x0::updateTemperatureFlag(int flag, bool trip, bool clear, int temperature)
+{
+  if (!(softwareErrorStatus & flag) && trip) {
+    softwareErrorStatus |= flag;
+    logEvent(LOG_BMS_TEMP_TRIP, flag, temperature);
+  }
+  else if ((softwareErrorStatus & flag) && clear) {
+    softwareErrorStatus &= ~flag;
+    logEvent(LOG_BMS_TEMP_CLEAR, flag, temperature);
+  }
+}
+
+//----------------------------------------------------------------------------
+// STAT_SW_UTC/OTC/UTD/OTD flags currently set, 0 if all temperatures are OK
+
+int bq769x0::getTemperatureStatus()
+{
+  return softwareErrorStatus & (STAT_SW_UTC | STAT_SW_OTC | STAT_SW_UTD | STAT_SW_OTD);
+}
+
+//----------------------------------------------------------------------------
+// Soft warnings: a warning is set when its value reaches the threshold and
+// cleared once it is back by more than the hysteresis. Thresholds in mV,
+// mA or °C/10, see WARN_*.
+
+bool bq769x0::setWarningBand(byte warning, int threshold, int hysteresis)
+{
+  if (warning >= NUM_WARNINGS || hysteresis < 0) {
+    return false;
+  }
+  bool low = (warning == WARN_CELL_LOW || warning == WARN_TEMP_LOW);
+  warningThreshold[warning] = low ? -threshold : threshold;
+  warningHysteresis[warning] = hysteresis;
+  warningEnabled |= 1 << warning;
+  return true;
+}
+
+bool bq769x0::disableWarning(byte warning)
+{
+  if (warning >= NUM_WARNINGS) {
+    return false;
+  }
+  warningEnabled &= ~(1 << warning);
+  if (warningStatus & (1 << warning)) {
+    warningStatus &= ~(1 << warning);
+    warningChanges |= 1 << warning;
+  }
+  return true;
+}
+
+byte bq769x0::getWarningStatus()
+{
+  return warningStatus;
+}
+
+byte bq769x0::getWarningChanges()
+{
+  byte changes = warningChanges;
+  warningChanges = 0;
+  return changes;
+}
+
+//----------------------------------------------------------------------------
+// Called at the end of every update pass with the values of this pass,
+// temperatures only when they were read
+
+void bq769x0::updateWarnings(bool temperaturesUpdated)
+{
+  // no conversion yet right after boot
+  if (cellVoltages[idCellMaxVoltage] > 500) {
+    updateWarning(WARN_CELL_LOW, -cellVoltages[idCellMinVoltage]);
+    updateWarning(WARN_CELL_HIGH, cellVoltages[idCellMaxVoltage]);
+  }
+  updateWarning(WARN_CHARGE_CURRENT, batCurrent);
+  updateWarning(WARN_DISCHARGE_CURRENT, -batCurrent);
+
+  if (temperaturesUpdated && temperaturesValid) {
+    int lowest = temperatures[0];
+    int highest = temperatures[0];
+    for (byte i = 1; i < type; i++) {
+      if (temperatures[i] < lowest) {
+        lowest = temperatures[i];
+      }
+      if (temperatures[i] > highest) {
+        highest = temperatures[i];
+      }
+    }
+    updateWarning(WARN_TEMP_LOW, -lowest);
+    updateWarning(WARN_TEMP_HIGH, highest);
+  }
+}
+
+void bq769x0::updateWarning(byte warning, int value)
+{
+  byte flag = 1 << warning;
+  if (!(warningEnabled & flag)) {
+    return;
+  }
+
+  if (!(warningStatus & flag) && value >= warningThreshold[warning]) {
+    warningStatus |= flag;
+    warningChanges |= flag;
+  }
+  else if ((warningStatus & flag) &&
+    value < warningThreshold[warning] - warningHysteresis[warning])
+  {
+    warningStatus &= ~flag;
+    warningChanges |= flag;
   }
 }
 
@@ -625,13 +1229,20 @@ void bq769x0::updateTemperatures()
 
 void bq769x0::updateCurrent(bool ignoreCCReadyFlag)
 {
+  TRACE_CALLER(TRACE_CURRENT);
   int16_t adcVal = 0;
+  uint8_t data[2];
   regSYS_STAT_t sys_stat;
-  sys_stat.regByte = readRegister(SYS_STAT);
+  int stat = readRegister(SYS_STAT);
+  if (stat < 0) {
+    return;
+  }
+  sys_stat.regByte = stat;
   
-  if (ignoreCCReadyFlag == true || sys_stat.bits.CC_READY == 1)
+  if ((ignoreCCReadyFlag == true || sys_stat.bits.CC_READY == 1) &&
+    readBlock(CC_HI_BYTE, data, 2))
   {
-    adcVal = (readRegister(0x32) << 8) | readRegister(0x33);
+    adcVal = (data[0] << 8) | data[1];
     batCurrent = (long)(adcVal * 844) / (long)(100*shuntResistorValue_mOhm);  // mA
 
     // if (batCurrent > -10 && batCurrent < 10)
@@ -650,7 +1261,107 @@ void bq769x0::updateCurrent(bool ignoreCCReadyFlag)
     }
 
     writeRegister(SYS_STAT, B10000000);  // Clear CC ready flag	
+
+    currentUpdated = true;
+    checkChargeOvercurrent();
+  }
+}
+
+//----------------------------------------------------------------------------
+// Software charge overcurrent protection, called for every new CC sample.
+// Trips when the average charge current over the last occWindowLength
+// samples exceeds occThreshold_mA, i.e. at most one CC period after the
+// configured delay. Constant time: the window is a ring with a running sum.
+
+void bq769x0::checkChargeOvercurrent()
+{
+  if (occThreshold_mA <= 0) {
+    return;
+  }
+
+  if (softwareErrorStatus & STAT_SW_OCC)
+  {
+    // same recovery as for OCD: retry after a minute. This runs inside
+    // updateCurrent(), which checkStatus() calls as well, so only the flag
+    // is cleared here and finishUpdate() switches CHG back on.
+    if (millis() - occTripTimestamp >= OCC_RECOVERY_MS) {
+      softwareErrorStatus &= ~STAT_SW_OCC;
+      occWindowCount = 0;
+      occWindowSum = 0;
+      logEvent(LOG_BMS_OCC_CLEAR, batCurrent / 100);
+    }
+    return;
+  }
+
+  // only charge current counts
+  long sample = (batCurrent > 0) ? batCurrent : 0;
+
+  if (occWindowCount == occWindowLength) {
+    occWindowSum -= occWindow[occWindowIndex];
+  }
+  else {
+    occWindowCount++;
+  }
+  occWindow[occWindowIndex] = sample;
+  occWindowSum += sample;
+  if (++occWindowIndex >= occWindowLength) {
+    occWindowIndex = 0;
+  }
+
+  if (occWindowCount == occWindowLength &&
+    occWindowSum > occThreshold_mA * occWindowLength)
+  {
+    // restore CHG after the recovery only if the application had it on
+    occRestoreCharging = tripFets(FET_CHG) != 0;
+    softwareErrorStatus |= STAT_SW_OCC;
+    occTripTimestamp = millis();
+    logEvent(LOG_BMS_OCC_TRIP, batCurrent / 100);
+  }
+}
+
+//----------------------------------------------------------------------------
+// Online internal resistance estimate per cell, R = dV/dI over current steps.
+// Recursive least squares with forgetting factor 1 - 2^-IR_FORGETTING_SHIFT:
+// for one parameter it reduces to exponentially weighted sums of dI*dI and
+// dI*dV. dI is the same for all cells, so each update costs one multiply and
+// shift per cell; the division is left to getCellResistance().
+
+void bq769x0::updateResistanceEstimate()
+{
+  long dI = batCurrent - irPrevCurrent;
+  bool stepValid = irPrevValid &&
+    millis() - irPrevTimestamp <= 2 * CC_SAMPLE_PERIOD_MS &&
+    abs(dI) >= IR_MIN_CURRENT_STEP_MA;
+
+  if (stepValid)
+  {
+    irSumII += (int64_t)dI * dI - (irSumII >> IR_FORGETTING_SHIFT);
+    for (int i = 0; i < numberOfCells; i++) {
+      long dV = cellVoltages[i] - irPrevVoltages[i];
+      irSumIV[i] += (int64_t)dI * dV - (irSumIV[i] >> IR_FORGETTING_SHIFT);
+    }
+  }
+
+  irPrevCurrent = batCurrent;
+  for (int i = 0; i < numberOfCells; i++) {
+    irPrevVoltages[i] = cellVoltages[i];
+  }
+  irPrevTimestamp = millis();
+  irPrevValid = true;
+}
+
+//----------------------------------------------------------------------------
+// returns the estimated internal resistance in uOhm, 0 if there was no
+// current step yet
+
+long bq769x0::getCellResistance(byte idCell)
+{
+  if (idCell >= numberOfCells || irSumII == 0) {
+    return 0;
   }
+  // dV in mV, dI in mA: dV/dI * 1e6 = uOhm
+  long resistance = irSumIV[idCell] * 1000000 / irSumII;
+  return (resistance > 0) ? resistance : 0;
 }
 
 //----------------------------------------------------------------------------
@@ -658,24 +1369,84 @@ void bq769x0::updateCurrent(bool ignoreCCReadyFlag)
 
 void bq769x0::updateVoltages()
 {
+  requestCellVoltages();
+  readCellVoltages();
+  updatePackVoltage();
+}
+
+//----------------------------------------------------------------------------
+
+void bq769x0::updatePackVoltage()
+{
+  TRACE_CALLER(TRACE_PACK);
   long adcVal = 0;
+  uint8_t data[2];
   
   // read battery pack voltage
-  adcVal = (readRegister(BAT_HI_BYTE) << 8) | readRegister(BAT_LO_BYTE);
+  if (!readBlock(BAT_HI_BYTE, data, 2)) {
+    return;
+  }
+  adcVal = (data[0] << 8) | data[1];
   batVoltage = (4 * adcGain * adcVal) / 1000 + (numberOfCells * adcOffset);
-  
-  // read cell voltages
+}
+
+//----------------------------------------------------------------------------
+// starts the cell voltage block read, returns without waiting for the data
+
+void bq769x0::requestCellVoltages()
+{
+  TRACE_CALLER(TRACE_CELLS);
   _wire->beginTransmission(I2CAddress);
   _wire->write(VC1_HI_BYTE);
-  _wire->endTransmission();
+  cellRequestSent = (_wire->endTransmission() == 0);
   
- _wire->requestFrom(I2CAddress, 2 * numberOfCells);
+  if (cellRequestSent) {
+    _wire->sendRequest(I2CAddress, 4 * numberOfCells, I2C_STOP);  // data and CRC bytes
+  }
+}
+
+//----------------------------------------------------------------------------
+// waits for the block read started by requestCellVoltages()
+
+void bq769x0::readCellVoltages()
+{
+  TRACE_CALLER(TRACE_CELLS);
+  long adcVal = 0;
+  uint8_t raw[4 * MAX_NUMBER_OF_CELLS];
+  uint8_t data[2 * MAX_NUMBER_OF_CELLS];
+  bool valid = false;
+
+  if (cellRequestSent) {
+    _wire->finish();
+    if (_wire->available() == 4 * numberOfCells) {
+      for (int i = 0; i < 4 * numberOfCells; i++) {
+        raw[i] = _wire->read();
+      }
+      valid = decodeBlock(raw, data, 2 * numberOfCells);
+      linkResult(!valid, false);
+    }
+    else {
+      linkResult(false, true);
+    }
+  }
+  else {
+    linkResult(false, true);
+  }
+  TRACE_TRANSFER(valid ? TRACE_READ : TRACE_READ | TRACE_FAILED, VC1_HI_BYTE,
+    data, 2 * numberOfCells);
+
+  // failed, fall back to a blocking read with retries and keep the old
+  // values if that fails as well
+  if (!valid && !readBlock(VC1_HI_BYTE, data, 2 * numberOfCells)) {
+    return;
+  }
 
   idCellMaxVoltage = 0;
   idCellMinVoltage = 0;
   for (int i = 0; i < numberOfCells; i++)
   {
-    adcVal = (_wire->read() << 8) | _wire->read();
+    adcVal = data[2*i] << 8;
+    adcVal |= data[2*i + 1];
     cellVoltages[i] = (adcVal * adcGain)/1000 + adcOffset;
 
     if (cellVoltages[i] > cellVoltages[idCellMaxVoltage]) {
@@ -689,25 +1460,181 @@ void bq769x0::updateVoltages()
 
 //----------------------------------------------------------------------------
 
-void bq769x0::writeRegister(byte address, uint8_t data)
+
+bool bq769x0::writeRegister(byte address, uint8_t data)
 {
-  uint8_t crcData[3] = {(I2CAddress<<1), address, data};
-  _wire->beginTransmission(I2CAddress);
-  _wire->write(address);
-  _wire->write(data);
-  _wire->write(CRC8.smbus(crcData,3));
-  _wire->endTransmission();
+  return writeBlock(address, &data, 1);
+}
+
+//----------------------------------------------------------------------------
+// Writes length consecutive registers. Each data byte is followed by its
+// CRC, the first one includes the slave address and register address.
+// The IC checks the CRCs and ignores corrupted writes, so only errors
+// reported by the bus can be retried here.
+
+bool bq769x0::writeBlock(byte address, const uint8_t *data, byte length)
+{
+  uint8_t first[3] = {(uint8_t)(I2CAddress << 1), address, data[0]};
+
+  for (byte attempt = 0; attempt <= I2C_RETRIES; attempt++)
+  {
+    if (attempt > 0) {
+      delayMicroseconds(I2C_RETRY_DELAY_US << (attempt - 1));
+    }
+    _wire->beginTransmission(I2CAddress);
+    _wire->write(address);
+    _wire->write(data[0]);
+    _wire->write(CRC8.smbus(first, 3));
+    for (byte i = 1; i < length; i++) {
+      _wire->write(data[i]);
+      _wire->write(CRC8.smbus(&data[i], 1));
+    }
+    if (_wire->endTransmission() == 0) {
+      TRACE_TRANSFER(TRACE_WRITE, address, data, length);
+      linkResult(false, false);
+      return true;
+    }
+    TRACE_TRANSFER(TRACE_WRITE | TRACE_FAILED, address, data, length);
+    linkResult(false, true);
+  }
+  linkStats.failures++;
+  logEvent(LOG_BMS_I2C_FAIL, address, linkStats.failures);
+  return false;
 }
 
 //----------------------------------------------------------------------------
 
 int bq769x0::readRegister(byte address)
-{  
-  _wire->beginTransmission(I2CAddress);
-  _wire->write(address);
-  _wire->endTransmission();
-  _wire->requestFrom(I2CAddress, 2); // TODO: add CRC check for incoming data
-  return _wire->read();
+{
+  uint8_t data;
+  if (readBlock(address, &data, 1)) {
+    return data;
+  }
+  return -1;
+}
+
+//----------------------------------------------------------------------------
+// Reads length consecutive registers. With CRC enabled the IC sends a CRC
+// after every data byte, so 2 * length bytes are transferred.
+
+bool bq769x0::readBlock(byte address, uint8_t *data, byte length)
+{
+  uint8_t raw[2 * I2C_MAX_BLOCK];
+
+  for (byte attempt = 0; attempt <= I2C_RETRIES; attempt++)
+  {
+    if (attempt > 0) {
+      delayMicroseconds(I2C_RETRY_DELAY_US << (attempt - 1));
+    }
+    _wire->beginTransmission(I2CAddress);
+    _wire->write(address);
+    if (_wire->endTransmission() != 0 ||
+      _wire->requestFrom(I2CAddress, 2 * length) != 2 * length)
+    {
+      TRACE_TRANSFER(TRACE_READ | TRACE_FAILED, address, 0, length);
+      linkResult(false, true);
+      continue;
+    }
+    for (byte i = 0; i < 2 * length; i++) {
+      raw[i] = _wire->read();
+    }
+    if (decodeBlock(raw, data, length)) {
+      TRACE_TRANSFER(TRACE_READ, address, data, length);
+      linkResult(false, false);
+      return true;
+    }
+    TRACE_TRANSFER(TRACE_READ | TRACE_FAILED, address, 0, length);
+    linkResult(true, false);
+  }
+  linkStats.failures++;
+  logEvent(LOG_BMS_I2C_FAIL, address, linkStats.failures);
+  return false;
+}
+
+//----------------------------------------------------------------------------
+// Checks the CRC after each data byte and copies the data bytes. The CRC of
+// the first byte includes the slave address (read), later ones cover only
+// their data byte.
+
+bool bq769x0::decodeBlock(const uint8_t *raw, uint8_t *data, byte length)
+{
+  uint8_t first[2] = {(uint8_t)((I2CAddress << 1) | 1), raw[0]};
+  if (CRC8.smbus(first, 2) != raw[1]) {
+    return false;
+  }
+  data[0] = raw[0];
+
+  for (byte i = 1; i < length; i++) {
+    if (CRC8.smbus(&raw[2*i], 1) != raw[2*i + 1]) {
+      return false;
+    }
+    data[i] = raw[2*i];
+  }
+  return true;
+}
+
+//----------------------------------------------------------------------------
+// Error statistics and clock selection: too many errors within a window
+// halve the bus clock at once, a window without errors doubles it.
+
+void bq769x0::linkResult(bool crcError, bool busError)
+{
+  linkStats.transfers++;
+  if (crcError) {
+    linkStats.crcErrors++;
+    windowErrors++;
+  }
+  if (busError) {
+    linkStats.busErrors++;
+    windowErrors++;
+  }
+
+  if (windowErrors > I2C_CLOCK_MAX_ERRORS) {
+    stepClock(false);
+  }
+  else if (++windowTransfers >= I2C_CLOCK_WINDOW) {
+    stepClock(windowErrors == 0);
+  }
+}
+
+void bq769x0::stepClock(bool up)
+{
+  unsigned long clock = up ? linkStats.clock * 2 : linkStats.clock / 2;
+  if (clock > clockMax) {
+    clock = clockMax;
+  }
+  if (clock < clockMin) {
+    clock = clockMin;
+  }
+
+  if (clock != linkStats.clock) {
+    linkStats.clock = clock;
+    _wire->setClock(clock);
+    logEvent(LOG_BMS_I2C_CLOCK, clock / 1000, windowErrors);
+  }
+  windowTransfers = 0;
+  windowErrors = 0;
+}
+
+//----------------------------------------------------------------------------
+
+void bq769x0::setI2CClockRange(unsigned long min_Hz, unsigned long max_Hz)
+{
+  clockMin = min_Hz;
+  clockMax = max_Hz;
+  linkStats.clock = min_Hz;
+  windowTransfers = 0;
+  windowErrors = 0;
+  if (_wire != 0) {
+    _wire->setClock(min_Hz);
+  }
+}
+
+//----------------------------------------------------------------------------
+
+i2c_link_stats bq769x0::getLinkStats()
+{
+  return linkStats;
 }
 
 //----------------------------------------------------------------------------
@@ -715,22 +1642,29 @@ int bq769x0::readRegister(byte address)
 
 void bq769x0::setAlertInterruptFlag()
 {
-  interruptTimestamp = millis();
   alertInterruptFlag = true;
 }
 
 //----------------------------------------------------------------------------
 // The bq769x0 drives the ALERT pin high if the SYS_STAT register contains
-// a new value (either new CC reading or an error)
+// a new value (either new CC reading or an error). All instances sharing
+// the pin of the slot are flagged, each of them checks its own SYS_STAT.
 
-void bq769x0::alertISR()
+void bq769x0::dispatchAlert(byte slot)
 {
-  if (instancePointer != 0)
-  {
-    instancePointer->setAlertInterruptFlag();
+  byte pin = instances[slot]->alertPin;
+  for (byte i = 0; i < BQ769X0_MAX_INSTANCES; i++) {
+    if (instances[i] != 0 && instances[i]->alertPin == pin) {
+      instances[i]->setAlertInterruptFlag();
+    }
   }
 }
 
+i2c_t3 *bq769x0::getWire()
+{
+  return _wire;
+}
+
 
 #if BQ769X0_DEBUG
 
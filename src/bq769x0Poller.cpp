@@ -0,0 +1,61 @@
+#include "bq769x0Poller.h"
+
+bool bq769x0Poller::addPack(bq769x0 *pack) {
+  if (numPacks >= BQ769X0_MAX_INSTANCES) {
+    return false;
+  }
+  packs[numPacks++] = pack;
+  assignOffsets();
+  return true;
+}
+
+// The n-th of k packs on a bus is updated n/k of the way into the period,
+// so the first pack of every bus shares tick 0, the second ones share the
+// next slot, and so on.
+void bq769x0Poller::assignOffsets() {
+  for (uint8_t i = 0; i < numPacks; i++) {
+    uint8_t rank = 0;
+    uint8_t busCount = 0;
+    for (uint8_t j = 0; j < numPacks; j++) {
+      if (packs[j]->getWire() == packs[i]->getWire()) {
+        if (j < i) {
+          rank++;
+        }
+        busCount++;
+      }
+    }
+    tickOffset[i] = rank * BQ769X0_POLL_TICKS / busCount;
+  }
+}
+
+uint8_t bq769x0Poller::tick() {
+  uint8_t due = 0;
+
+  for (uint8_t i = 0; i < numPacks; i++) {
+    if (tickOffset[i] == tickCount) {
+      due |= 1 << i;
+    }
+  }
+  tickCount = (tickCount + 1) % BQ769X0_POLL_TICKS;
+
+  // at most one pack per bus is due, start all block reads before waiting
+  for (uint8_t i = 0; i < numPacks; i++) {
+    if (due & (1 << i)) {
+      packs[i]->beginUpdate();
+    }
+  }
+  for (uint8_t i = 0; i < numPacks; i++) {
+    if (due & (1 << i)) {
+      packs[i]->finishUpdate();
+    }
+  }
+  return due;
+}
+
+bq769x0 *bq769x0Poller::getPack(uint8_t index) {
+  return (index < numPacks) ? packs[index] : 0;
+}
+
+uint8_t bq769x0Poller::getNumberOfPacks() {
+  return numPacks;
+}
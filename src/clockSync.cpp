@@ -0,0 +1,65 @@
+#include "clockSync.h"
+
+static bool synced = false;
+static unsigned long syncLocal = 0;     // millis() of the last sync
+static int32_t syncOffset = 0;          // host time - millis() at syncLocal
+static int32_t drift_ppm = 0;
+
+// drift is measured over longer intervals than the syncs may come in
+static unsigned long driftLocal = 0;    // millis() of the last drift update
+static int32_t driftOffset = 0;         // measured offset at driftLocal
+
+// rounded, truncating would bias the drift loop by up to 1 ms per interval
+static int32_t extrapolate(int32_t offset, unsigned long from_ms, unsigned long to_ms) {
+  int64_t drift = (int64_t)drift_ppm * (int32_t)(to_ms - from_ms);
+  return offset + (int32_t)((drift + (drift < 0 ? -500000 : 500000)) / 1000000);
+}
+
+void clockSyncUpdate(uint32_t host_ms, uint16_t latency_ms, unsigned long local_ms) {
+  int32_t measured = (int32_t)(host_ms + latency_ms - (uint32_t)local_ms);
+
+  if (!synced) {
+    syncOffset = measured;
+    syncLocal = local_ms;
+    driftOffset = measured;
+    driftLocal = local_ms;
+    synced = true;
+    return;
+  }
+
+  int32_t predicted = extrapolate(syncOffset, syncLocal, local_ms);
+  syncOffset = predicted + (measured - predicted) / 2;
+  syncLocal = local_ms;
+
+  // drift from the raw measurements, the corrected offset above already
+  // holds half of the error and would bias it
+  int32_t driftElapsed = local_ms - driftLocal;
+  if (driftElapsed >= CLOCK_DRIFT_MIN_INTERVAL_MS) {
+    int32_t error = measured - extrapolate(driftOffset, driftLocal, local_ms);
+    drift_ppm += (int32_t)((int64_t)error * 1000000 / driftElapsed / 4);
+    if (drift_ppm > CLOCK_MAX_DRIFT_PPM) {
+      drift_ppm = CLOCK_MAX_DRIFT_PPM;
+    }
+    if (drift_ppm < -CLOCK_MAX_DRIFT_PPM) {
+      drift_ppm = -CLOCK_MAX_DRIFT_PPM;
+    }
+    driftOffset = measured;
+    driftLocal = local_ms;
+  }
+}
+
+uint32_t clockHostTime(unsigned long local_ms) {
+  return local_ms + extrapolate(syncOffset, syncLocal, local_ms);
+}
+
+bool clockSynced() {
+  return synced;
+}
+
+int32_t clockOffset() {
+  return syncOffset;
+}
+
+int32_t clockDrift() {
+  return drift_ppm;
+}
@@ -0,0 +1,121 @@
+#include "colorSensor.h"
+
+// TAOS DN25 coefficients, scaled to Q12
+const color_calibration colorDefaultCalibration = {
+  { -585, 6346, -3917,      // X
+    -1330, 6465, -2998,     // Y
+    -2794, 3157, 2307 },    // Z
+  256                       // 1 lux per Y count
+};
+
+static color_calibration calibration = colorDefaultCalibration;
+static color_result result;
+static uint16_t saturation = COLOR_MAX_COUNT;   // clear count at which the sensor clips
+static uint16_t integration = COLOR_LUX_INTEGRATION_MS;
+
+// McCamy: n = (x - 0.3320) / (0.1858 - y), x and y in 1/65536
+#define MCCAMY_XE   21758
+#define MCCAMY_YE   12177
+
+static int32_t matrixRow(uint8_t row, int32_t r, int32_t g, int32_t b) {
+  // 16 bit counts times Q12 coefficients can exceed 32 bit when summed
+  int64_t sum = (int64_t)calibration.matrix[3*row] * r +
+    (int64_t)calibration.matrix[3*row+1] * g +
+    (int64_t)calibration.matrix[3*row+2] * b;
+  return sum >> 12;
+}
+
+static uint16_t mccamy(int32_t x, int32_t y) {
+  // white light is well above the epicenter, below it n runs off
+  if (y <= MCCAMY_YE + 2048) {
+    return 0;
+  }
+  int32_t n = ((x - MCCAMY_XE) << 12) / (MCCAMY_YE - y);    // Q12
+  // the cubic turns over outside about -0.9 < n < 3
+  if (n < -3686 || n > 12288) {
+    return 0;
+  }
+  int32_t n2 = (n * n) >> 12;
+  int32_t n3 = (n2 * n) >> 12;
+  int32_t cct = ((449 * n3 + 3525 * n2 + 6823 * n) >> 12) + 5520;
+  if (cct < 0 || cct > 0xFFFF) {
+    return 0;
+  }
+  return cct;
+}
+
+void colorUpdate(const uint8_t *sample) {
+  int32_t r = (sample[0] << 8) | sample[1];
+  int32_t g = (sample[2] << 8) | sample[3];
+  int32_t b = (sample[4] << 8) | sample[5];
+  uint16_t c = (sample[6] << 8) | sample[7];
+
+  int32_t X = matrixRow(0, r, g, b);
+  int32_t Y = matrixRow(1, r, g, b);
+  int32_t Z = matrixRow(2, r, g, b);
+  // the matrix may push dark or strongly saturated colors slightly negative
+  if (X < 0) {
+    X = 0;
+  }
+  if (Y < 0) {
+    Y = 0;
+  }
+  if (Z < 0) {
+    Z = 0;
+  }
+
+  // counts grow with the integration time, luxScale holds for
+  // COLOR_LUX_INTEGRATION_MS
+  result.flags = 0;
+  result.lux = (((uint64_t)Y * calibration.luxScale * COLOR_LUX_INTEGRATION_MS) / integration) >> 8;
+  if (c >= saturation) {
+    result.flags |= COLOR_SATURATED;
+  }
+
+  int32_t sum = X + Y + Z;
+  if (c < COLOR_MIN_CLEAR || sum == 0) {
+    result.flags |= COLOR_DARK;
+    result.x = 0;
+    result.y = 0;
+    result.cct = 0;
+    return;
+  }
+
+  // X and Y reach 2^19, too wide to shift by 16 in 32 bit. A pure X or Y
+  // gives 1.0, which only fits as 0xFFFF.
+  int64_t x = ((int64_t)X << 16) / sum;
+  int64_t y = ((int64_t)Y << 16) / sum;
+  result.x = (x > 0xFFFF) ? 0xFFFF : x;
+  result.y = (y > 0xFFFF) ? 0xFFFF : y;
+  result.cct = mccamy(result.x, result.y);
+  result.flags |= COLOR_VALID;
+}
+
+const color_result &colorResult() {
+  return result;
+}
+
+void colorSetIntegrationTime(uint16_t integration_ms) {
+  integration = (integration_ms > 0) ? integration_ms : 1;
+
+  // rounded down, a cycle short flags saturation slightly early where a
+  // cycle too many would miss it
+  uint32_t cycles = (uint32_t)integration_ms * 1000 / COLOR_CYCLE_US;
+  if (cycles < 1) {
+    cycles = 1;
+  }
+  uint32_t clip = cycles * COLOR_CYCLE_COUNTS;
+  saturation = clip > COLOR_MAX_COUNT ? COLOR_MAX_COUNT : clip;
+}
+
+uint16_t colorSaturation() {
+  return saturation;
+}
+
+void colorSetCalibration(const color_calibration &newCalibration) {
+  calibration = newCalibration;
+}
+
+const color_calibration &colorCalibration() {
+  return calibration;
+}
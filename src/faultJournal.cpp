@@ -0,0 +1,163 @@
+#include <EEPROM.h>
+#include <FastCRC.h>
+
+#include "faultJournal.h"
+#include "eepromLayout.h"
+
+static_assert(sizeof(journal_entry) * EEPROM_JOURNAL_ENTRIES ==
+  EEPROM_JOURNAL_END - EEPROM_JOURNAL_START, "journal entry size does not match eepromLayout.h");
+
+static FastCRC8 journalCRC;
+
+// RAM copy of the EEPROM ring, so sending the journal never reads EEPROM
+static journal_entry journal[EEPROM_JOURNAL_ENTRIES];
+static uint8_t journalNext = 0;         // slot the next entry goes to
+static uint8_t journalSequence = 0;     // sequence of the newest entry
+
+// Entries waiting for journalFlush()
+static journal_entry queue[JOURNAL_QUEUE_SIZE];
+static uint8_t queueHead = 0;
+static uint8_t queueCount = 0;
+static uint8_t droppedEntries = 0;
+
+// Write rate limit, one token per entry
+static uint8_t writeTokens = JOURNAL_WRITE_BURST;
+static unsigned long tokenTimestamp = 0;
+
+static int lastStatus = 0;
+
+static uint8_t entryCRC(const journal_entry &entry) {
+  return journalCRC.smbus((const uint8_t *)&entry, sizeof(journal_entry) - 1) ^ JOURNAL_CRC_XOR;
+}
+
+static bool entryValid(const journal_entry &entry) {
+  return entry.event != 0xFF &&                 // erased EEPROM
+    (entry.event & ~JOURNAL_SET) != 0 &&        // no flag has code 0, zeroed EEPROM
+    entry.crc == entryCRC(entry);
+}
+
+static uint8_t encodeCell(int voltage_mV) {
+  int code = (voltage_mV - 2000) >> 3;
+  if (code < 0) {
+    return 0;
+  }
+  return (code > 0xFF) ? 0xFF : code;
+}
+
+void journalSetup() {
+  bool found = false;
+
+  for (uint8_t i = 0; i < EEPROM_JOURNAL_ENTRIES; i++) {
+    EEPROM.get(EEPROM_JOURNAL_START + i * sizeof(journal_entry), journal[i]);
+    if (!entryValid(journal[i])) {
+      continue;
+    }
+    // the newest entry is the one the next slot does not continue from
+    if (!found || (int8_t)(journal[i].sequence - journalSequence) > 0) {
+      journalSequence = journal[i].sequence;
+      journalNext = (i + 1) % EEPROM_JOURNAL_ENTRIES;
+      found = true;
+    }
+  }
+  tokenTimestamp = millis();
+}
+
+static void queueEntry(uint8_t event, int minCell_mV, int maxCell_mV) {
+  if (queueCount >= JOURNAL_QUEUE_SIZE) {
+    if (droppedEntries < 0xFF) {
+      droppedEntries++;
+    }
+    return;
+  }
+  unsigned long uptime = millis() / 1000;
+  journal_entry *entry = &queue[(queueHead + queueCount) % JOURNAL_QUEUE_SIZE];
+  entry->event = event;
+  entry->uptime[0] = uptime & 0xFF;
+  entry->uptime[1] = (uptime >> 8) & 0xFF;
+  entry->uptime[2] = (uptime >> 16) & 0xFF;
+  entry->minCell = encodeCell(minCell_mV);
+  entry->maxCell = encodeCell(maxCell_mV);
+  queueCount++;
+}
+
+void journalUpdate(bq769x0 &bms) {
+  int status = bms.getErrorStatus();
+  int changed = status ^ lastStatus;
+  lastStatus = status;
+
+  for (uint8_t bit = 0; changed != 0; bit++, changed >>= 1) {
+    if (changed & 1) {
+      uint8_t event = (bit + 1) | ((status & (1 << bit)) ? JOURNAL_SET : 0);
+      queueEntry(event, bms.getMinCellVoltage(), bms.getMaxCellVoltage());
+    }
+  }
+}
+
+static void writeEntry(journal_entry *entry) {
+  entry->sequence = ++journalSequence;
+  entry->crc = entryCRC(*entry);
+
+  journal[journalNext] = *entry;
+  EEPROM.put(EEPROM_JOURNAL_START + journalNext * sizeof(journal_entry), *entry);
+  journalNext = (journalNext + 1) % EEPROM_JOURNAL_ENTRIES;
+  writeTokens--;
+}
+
+void journalFlush() {
+  // refill in whole intervals, a full bucket does not save up time
+  unsigned long now = millis();
+  while (writeTokens < JOURNAL_WRITE_BURST &&
+    now - tokenTimestamp >= JOURNAL_WRITE_INTERVAL_MS)
+  {
+    tokenTimestamp += JOURNAL_WRITE_INTERVAL_MS;
+    writeTokens++;
+  }
+  if (writeTokens == JOURNAL_WRITE_BURST) {
+    tokenTimestamp = now;
+  }
+
+  // one entry per call keeps the EEPROM write time out of a single loop pass
+  if (writeTokens == 0) {
+    return;
+  }
+  if (queueCount > 0) {
+    writeEntry(&queue[queueHead]);
+    queueHead = (queueHead + 1) % JOURNAL_QUEUE_SIZE;
+    queueCount--;
+  }
+  else if (droppedEntries > 0) {
+    journal_entry entry;
+    memset(&entry, 0, sizeof(entry));
+    entry.event = JOURNAL_DROPPED;
+    entry.minCell = droppedEntries;
+    droppedEntries = 0;
+    writeEntry(&entry);
+  }
+}
+
+void journalSend(void (*send)(const uint8_t *buffer, size_t size)) {
+  uint8_t frame[3 + JOURNAL_ENTRIES_PER_FRAME * sizeof(journal_entry)];
+  uint8_t frameIndex = 0;
+  uint8_t count = 0;
+
+  // journalNext is the oldest slot once the ring has wrapped
+  for (uint8_t i = 0; i < EEPROM_JOURNAL_ENTRIES; i++) {
+    const journal_entry *entry = &journal[(journalNext + i) % EEPROM_JOURNAL_ENTRIES];
+    if (!entryValid(*entry)) {
+      continue;
+    }
+    memcpy(&frame[3 + count * sizeof(journal_entry)], entry, sizeof(journal_entry));
+    if (++count == JOURNAL_ENTRIES_PER_FRAME) {
+      frame[0] = 5;
+      frame[1] = frameIndex++;
+      frame[2] = count;
+      send(frame, 3 + count * sizeof(journal_entry));
+      count = 0;
+    }
+  }
+  // last, possibly empty frame tells the host the journal is complete
+  frame[0] = 5;
+  frame[1] = frameIndex;
+  frame[2] = count;
+  send(frame, 3 + count * sizeof(journal_entry));
+}
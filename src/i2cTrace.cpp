@@ -0,0 +1,94 @@
+#include <FastCRC.h>
+
+#include "i2cTrace.h"
+
+#if BQ769X0_TRACE
+
+static FastCRC8 traceCRC;
+
+static i2c_trace_record traceRing[I2C_TRACE_SIZE];
+static uint8_t traceHead = 0;           // next record to write
+static uint8_t traceCount = 0;
+static uint16_t traceLost = 0;          // overwritten since traceStart()
+static bool traceEnabled = false;
+
+uint8_t traceCaller = TRACE_OTHER;
+
+void traceStart() {
+  traceHead = 0;
+  traceCount = 0;
+  traceLost = 0;
+  traceEnabled = true;
+}
+
+void traceStop() {
+  traceEnabled = false;
+}
+
+// The newest records matter most when something went wrong, so a full ring
+// overwrites the oldest one
+void traceRecord(uint8_t address, uint8_t flags, uint8_t reg, const uint8_t *data,
+  uint8_t length, unsigned long clock)
+{
+  if (!traceEnabled) {
+    return;
+  }
+  i2c_trace_record *rec = &traceRing[traceHead];
+  rec->time = millis();
+  rec->address = address;
+  rec->flags = flags | ((clock / 100000) << TRACE_CLOCK_SHIFT);
+  rec->caller = traceCaller;
+  rec->reg = reg;
+  rec->length = length;
+  if (data == 0 || length == 0) {
+    rec->data = 0;
+  }
+  else {
+    rec->data = (length == 1) ? data[0] : traceCRC.smbus(data, length);
+  }
+
+  traceHead = (traceHead + 1) & (I2C_TRACE_SIZE - 1);
+  if (traceCount < I2C_TRACE_SIZE) {
+    traceCount++;
+  }
+  else {
+    traceLost++;
+  }
+}
+
+static void sendFrame(void (*send)(const uint8_t *buffer, size_t size), uint8_t *frame,
+  uint8_t frameIndex, uint8_t count)
+{
+  frame[0] = 8;
+  frame[1] = frameIndex;
+  frame[2] = count;
+  frame[3] = traceLost & 0xFF;
+  frame[4] = traceLost >> 8;
+  send(frame, 5 + count * sizeof(i2c_trace_record));
+}
+
+void traceSend(void (*send)(const uint8_t *buffer, size_t size)) {
+  uint8_t frame[5 + I2C_TRACE_RECORDS_PER_FRAME * sizeof(i2c_trace_record)];
+  uint8_t frameIndex = 0;
+  uint8_t count = 0;
+
+  // the snapshot must not change while it is sent
+  bool enabled = traceEnabled;
+  traceEnabled = false;
+
+  uint8_t oldest = (traceHead - traceCount) & (I2C_TRACE_SIZE - 1);
+  for (uint8_t i = 0; i < traceCount; i++) {
+    memcpy(&frame[5 + count * sizeof(i2c_trace_record)],
+      &traceRing[(oldest + i) & (I2C_TRACE_SIZE - 1)], sizeof(i2c_trace_record));
+    if (++count == I2C_TRACE_RECORDS_PER_FRAME) {
+      sendFrame(send, frame, frameIndex++, count);
+      count = 0;
+    }
+  }
+  // last, possibly empty frame tells the host the capture is complete
+  sendFrame(send, frame, frameIndex, count);
+
+  traceEnabled = enabled;
+}
+
+#endif // BQ769X0_TRACE
@@ -0,0 +1,72 @@
+#include "logRing.h"
+
+static log_record logRing[LOG_RING_SIZE];
+static volatile uint8_t logHead = 0;      // next slot to write, owned by logEvent()
+static volatile uint8_t logTail = 0;      // next slot to send, owned by logDrain()
+static volatile uint16_t logDropCount = 0;
+
+void logEvent(uint8_t event, int16_t arg0, int16_t arg1) {
+  noInterrupts();
+  uint8_t head = logHead;
+  if ((uint8_t)(head - logTail) >= LOG_RING_SIZE) {
+    // Ring full, keep the oldest records and count what was lost
+    logDropCount++;
+    interrupts();
+    return;
+  }
+  log_record *rec = &logRing[head & (LOG_RING_SIZE - 1)];
+  rec->timestamp = millis();
+  rec->event = event;
+  rec->arg0 = arg0;
+  rec->arg1 = arg1;
+  logHead = head + 1;
+  interrupts();
+}
+
+static void logSend(const log_record *rec) {
+  uint8_t frame[LOG_FRAME_SIZE];
+  uint8_t checksum = 0;
+
+  frame[0] = LOG_SYNC;
+  frame[1] = rec->timestamp & 0xFF;
+  frame[2] = (rec->timestamp >> 8) & 0xFF;
+  frame[3] = (rec->timestamp >> 16) & 0xFF;
+  frame[4] = (rec->timestamp >> 24) & 0xFF;
+  frame[5] = rec->event;
+  frame[6] = rec->arg0 & 0xFF;
+  frame[7] = (rec->arg0 >> 8) & 0xFF;
+  frame[8] = rec->arg1 & 0xFF;
+  frame[9] = (rec->arg1 >> 8) & 0xFF;
+  for (int i = 1; i < LOG_FRAME_SIZE - 1; i++) {
+    checksum ^= frame[i];
+  }
+  frame[LOG_FRAME_SIZE - 1] = checksum;
+
+  Serial.write(frame, LOG_FRAME_SIZE);
+}
+
+void logDrain() {
+  // Nothing listening, leave the records queued
+  if (!Serial) {
+    return;
+  }
+
+  while (logTail != logHead && Serial.availableForWrite() >= LOG_FRAME_SIZE) {
+    logSend(&logRing[logTail & (LOG_RING_SIZE - 1)]);
+    logTail = logTail + 1;
+  }
+
+  // Report losses once the ring has room again, so the gap is visible in order
+  if (logDropCount != 0 && logTail == logHead &&
+      Serial.availableForWrite() >= LOG_FRAME_SIZE) {
+    log_record dropped;
+    noInterrupts();
+    dropped.arg0 = logDropCount;
+    logDropCount = 0;
+    interrupts();
+    dropped.timestamp = millis();
+    dropped.event = LOG_DROPPED;
+    dropped.arg1 = 0;
+    logSend(&dropped);
+  }
+}
@@ -5,7 +5,17 @@
 #include "state.h"          // uC data storage
 #include "timer.h"          // Timer functions
 #include "RGBleds.h"        // Basic wrapper for OctoWS2811 library
+#include "batteryLeds.h"    // BMS state shown on the LED strips
+#include "batteryHealth.h"  // Capacity and SOH learning kept in EEPROM
+#include "faultJournal.h"   // BMS fault history kept in EEPROM
+#include "bmsConfig.h"      // BMS protection settings kept in EEPROM
 #include "bq769x0CRC.h"
+#include "bq769x0Poller.h"  // Staggered updates of one or more BMS ICs
+#include "logRing.h"        // Non-blocking binary event log
+#include "i2cTrace.h"       // BMS I2C transaction recorder
+#include "clockSync.h"      // Host clock estimate for timestamped telemetry
+#include "colorSensor.h"    // Chromaticity, lux and CCT of the color sensor samples
+#include "sensorLink.h"     // Rate and flow control of the color sensor link
 
 PacketSerial packetSerialOnion;
 PacketSerial packetSerialSensor;
@@ -31,14 +41,92 @@ uint8_t ledState = LOW;
 #endif
 #define BMS_I2C_ADDRESS 0x18  // Adress of chip bq7693007DBTR
 #define BMS_NUM_CELLS 10      // Number of cells attached to BMS
+#define BMS_DESIGN_CAPACITY_MAH 3000  // Rated capacity of the pack
 bq769x0 BMS(BMS_NUM_CELLS, bq76930, BMS_I2C_ADDRESS); // BMS object
+bq769x0Poller bmsPoller;
+
+// A second pack goes on Wire1 with its own ALERT pin, e.g.
+//   bq769x0 BMS2(BMS_NUM_CELLS, bq76930, BMS_I2C_ADDRESS);
+//   Wire1.begin(I2C_MASTER, 0x0, I2C_PINS_22_23, I2C_PULLUP_EXT, 100000);
+//   BMS2.begin(&Wire1, 15, -1);
+//   bmsPoller.addPack(&BMS2);
+// Its cell voltage reads then overlap with the ones of BMS.
 
 uint8_t battVoltage[2] = {0,0};
 uint8_t battCurrent[2] = {0,0};
 uint8_t batteryStatus[4];
+uint8_t cellResistances[2*BMS_NUM_CELLS];   // 10 uOhm units, high byte first
+uint8_t healthStatus[6];                    // capacity mAh, cycles, SOH 0.1 %
+uint8_t configReply[2 + sizeof(bq769x0_config)];  // command, result, config
+
+#define CONFIG_PERSIST 0x01   // flag of the config write command: also save to EEPROM
+#define CONFIG_RETRY_TICKS 500  // 5 s between attempts to apply an unverified config
+
+bq769x0_config bmsConfig;     // last valid config applied, kept to retry a failed write
+
+// Unsolicited frame sent when a soft warning is set or cleared:
+// [9][warning flags][changed flags][min cell mV][max cell mV][current mA],
+// 16 bit values high byte first
+uint8_t warningEvent[9];
+uint8_t warningBand[7];       // reply of command 10
 
 /* Color Sensor Data */
 uint8_t rgbc[8] = {0,0,0,0,0,0,0,0};
+uint8_t colorStatus[12];      // reply of command 13
+uint8_t colorCalibrationReply[1 + sizeof(color_calibration)];
+uint8_t sensorLinkReply[30];  // reply of command 15
+
+// millis() when the telemetry values were sampled
+unsigned long battSampleTime = 0;
+unsigned long rgbcSampleTime = 0;
+unsigned long bmsSampleTime = 0;
+
+uint8_t clockReply[17];       // reply of command 11
+bool stampTelemetry = false;  // set with command 12
+uint8_t stampReply[2];        // reply of command 12
+uint8_t stampedFrame[2*BMS_NUM_CELLS + 4];
+
+void sendOnion(const uint8_t* buffer, size_t size) {
+  packetSerialOnion.send(buffer, size);
+}
+
+// Protection registers that did not read back as written may hold anything,
+// so the FETs go off until the loop has applied the config successfully
+int applyBmsConfig(const bq769x0_config &config) {
+  int result = BMS.applyConfig(config);
+  if (result == CONFIG_INVALID) {
+    return result;
+  }
+  bmsConfig = config;
+  if (result == CONFIG_VERIFY_FAIL) {
+    BMS.disableCharging();
+    BMS.disableDischarging();
+  }
+  return result;
+}
+
+void sendSensor(const uint8_t* buffer, size_t size) {
+  packetSerialSensor.send(buffer, size);
+}
+
+void putBigEndian32(uint8_t* buffer, uint32_t value) {
+  buffer[0] = (value >> 24) & 0xFF;
+  buffer[1] = (value >> 16) & 0xFF;
+  buffer[2] = (value >> 8) & 0xFF;
+  buffer[3] = value & 0xFF;
+}
+
+// Telemetry frame, with the host time of its sample appended (4 bytes,
+// high byte first) if stamping is on
+void sendTelemetry(const uint8_t* buffer, size_t size, unsigned long sampleTime) {
+  if (!stampTelemetry || size + 4 > sizeof(stampedFrame)) {
+    packetSerialOnion.send(buffer, size);
+    return;
+  }
+  memcpy(stampedFrame, buffer, size);
+  putBigEndian32(&stampedFrame[size], clockHostTime(sampleTime));
+  packetSerialOnion.send(stampedFrame, size + 4);
+}
 
 void onPacketReceivedOnion(const uint8_t* buffer, size_t size) {
   switch (buffer[0])
@@ -50,13 +138,218 @@ void onPacketReceivedOnion(const uint8_t* buffer, size_t size) {
     case 01:
       memcpy(&batteryStatus[0], &battVoltage[0], 2*sizeof(uint8_t));
       memcpy(&batteryStatus[2], &battCurrent[0], 2*sizeof(uint8_t));
-      packetSerialOnion.send(batteryStatus, 4);
+      sendTelemetry(batteryStatus, 4, battSampleTime);
       break;
     
     case 02:
-      packetSerialOnion.send(rgbc, 8);
+      sendTelemetry(rgbc, 8, rgbcSampleTime);
+      break;
+
+    case 03:
+      for (int i = 0; i < BMS_NUM_CELLS; i++) {
+        long res = BMS.getCellResistance(i) / 10;
+        if (res > 0xFFFF) {
+          res = 0xFFFF;
+        }
+        cellResistances[2*i] = (res >> 8) & 0xFF;
+        cellResistances[2*i+1] = res & 0xFF;
+      }
+      sendTelemetry(cellResistances, 2*BMS_NUM_CELLS, bmsSampleTime);
+      break;
+
+    case 04:
+      healthStatus[0] = (healthCapacity() >> 8) & 0xFF;
+      healthStatus[1] = healthCapacity() & 0xFF;
+      healthStatus[2] = (healthCycles() >> 8) & 0xFF;
+      healthStatus[3] = healthCycles() & 0xFF;
+      healthStatus[4] = (healthSOH() >> 8) & 0xFF;
+      healthStatus[5] = healthSOH() & 0xFF;
+      sendTelemetry(healthStatus, 6, bmsSampleTime);
+      break;
+
+    case 05:
+      journalSend(sendOnion);
       break;
 
+    /*
+     * BMS configuration, a bq769x0_config as stored in EEPROM (packed,
+     * little endian). 06 reads it, 07 [07][flags][config] applies a new
+     * one. Both reply [command][CONFIG_* result][config], carrying
+     * the settings in effect, rounded to what the IC can do. A write of the
+     * wrong size is answered with CONFIG_INVALID. Packets are
+     * handled between two ticks, so a new configuration never takes effect
+     * in the middle of a BMS update.
+     */
+    case 06:
+    case 07: {
+      int result = CONFIG_OK;
+      if (buffer[0] == 07) {
+        bq769x0_config config;
+        if (size != 2 + sizeof(bq769x0_config)) {
+          result = CONFIG_INVALID;
+        }
+        else {
+          memcpy(&config, &buffer[2], sizeof(config));
+          result = applyBmsConfig(config);
+          if (result == CONFIG_OK && (buffer[1] & CONFIG_PERSIST)) {
+            configSave(config);
+          }
+        }
+      }
+      bq769x0_config actual = BMS.getConfig();
+      configReply[0] = buffer[0];
+      configReply[1] = result;
+      memcpy(&configReply[2], &actual, sizeof(actual));
+      packetSerialOnion.send(configReply, sizeof(configReply));
+      break;
+    }
+
+    // Soft warning band: [10][WARN_*][threshold][hysteresis] sets it,
+    // threshold and hysteresis 16 bit, high byte first, in mV, mA or °C/10.
+    // [10][WARN_*] disables it. Replies [10][1 if applied][WARN_*...], the
+    // request with the result inserted, 0 for an unknown band.
+    case 10: {
+      bool applied;
+      if (size == 6) {
+        applied = BMS.setWarningBand(buffer[1], (int16_t)((buffer[2] << 8) | buffer[3]),
+          (int16_t)((buffer[4] << 8) | buffer[5]));
+      }
+      else if (size == 2) {
+        applied = BMS.disableWarning(buffer[1]);
+      }
+      else {
+        break;
+      }
+      warningBand[0] = 10;
+      warningBand[1] = applied;
+      memcpy(&warningBand[2], &buffer[1], size - 1);
+      packetSerialOnion.send(warningBand, size + 1);
+      break;
+    }
+
+#if BQ769X0_TRACE
+    // I2C transaction recorder: [08][0] stops, [08][1] clears and starts,
+    // [08][2] sends the capture
+    case 8:
+      if (size < 2) {
+        break;
+      }
+      if (buffer[1] == 0) {
+        traceStop();
+      }
+      else if (buffer[1] == 1) {
+        traceStart();
+      }
+      else if (buffer[1] == 2) {
+        traceSend(sendOnion);
+      }
+      break;
+#endif
+
+    /*
+     * Clock sync: [11][host ms][latency ms], host ms 32 bit and the
+     * optional one way latency 16 bit, high byte first. Replies
+     * [11][host ms][millis() at arrival][offset ms][drift ppm], all 32 bit.
+     * Send it every few seconds, the drift estimate needs a minute or more.
+     */
+    case 11: {
+      unsigned long received = millis();
+      uint16_t latency = 0;
+      if (size != 5 && size != 7) {
+        break;
+      }
+      if (size == 7) {
+        latency = (buffer[5] << 8) | buffer[6];
+      }
+      uint32_t host = ((uint32_t)buffer[1] << 24) | ((uint32_t)buffer[2] << 16) |
+        ((uint32_t)buffer[3] << 8) | buffer[4];
+      clockSyncUpdate(host, latency, received);
+      clockReply[0] = 11;
+      memcpy(&clockReply[1], &buffer[1], 4);
+      putBigEndian32(&clockReply[5], received);
+      putBigEndian32(&clockReply[9], clockOffset());
+      putBigEndian32(&clockReply[13], clockDrift());
+      packetSerialOnion.send(clockReply, sizeof(clockReply));
+      break;
+    }
+
+    // [12][1] appends the host time of the sample to the replies of
+    // 01 to 04 and 13 and to warning events, [12][0] stops it. Replies with
+    // the request.
+    case 12:
+      if (size != 2) {
+        break;
+      }
+      stampTelemetry = buffer[1] != 0;
+      memcpy(stampReply, buffer, size);
+      packetSerialOnion.send(stampReply, size);
+      break;
+
+    // Processed color sample: [13][x][y][lux][cct][COLOR_* flags],
+    // x and y in 1/65536 and cct in K 16 bit, lux 32 bit, high byte first
+    case 13: {
+      const color_result &color = colorResult();
+      colorStatus[0] = 13;
+      colorStatus[1] = (color.x >> 8) & 0xFF;
+      colorStatus[2] = color.x & 0xFF;
+      colorStatus[3] = (color.y >> 8) & 0xFF;
+      colorStatus[4] = color.y & 0xFF;
+      putBigEndian32(&colorStatus[5], color.lux);
+      colorStatus[9] = (color.cct >> 8) & 0xFF;
+      colorStatus[10] = color.cct & 0xFF;
+      colorStatus[11] = color.flags;
+      sendTelemetry(colorStatus, sizeof(colorStatus), rgbcSampleTime);
+      break;
+    }
+
+    // Color calibration, a color_calibration (packed, little endian):
+    // [14] reads it, [14][calibration] sets it until the next reset.
+    // Replies [14][calibration in effect].
+    case 14:
+      if (size == 1 + sizeof(color_calibration)) {
+        color_calibration calibration;
+        memcpy(&calibration, &buffer[1], sizeof(calibration));
+        colorSetCalibration(calibration);
+      }
+      else if (size != 1) {
+        break;
+      }
+      colorCalibrationReply[0] = 14;
+      memcpy(&colorCalibrationReply[1], &colorCalibration(), sizeof(color_calibration));
+      packetSerialOnion.send(colorCalibrationReply, sizeof(colorCalibrationReply));
+      break;
+
+    /*
+     * Color sensor link: [15] reads, [15][period ms][integration ms], 16 bit
+     * high byte first, sets the sample rate. Replies [15][1 if accepted]
+     * [period][integration][samples][bad frames][lost][early][pauses]
+     * [timeouts], counters 32 bit, all high byte first.
+     */
+    case 15: {
+      bool accepted = 1;
+      if (size == 5) {
+        accepted = sensorLinkConfigure((buffer[1] << 8) | buffer[2], (buffer[3] << 8) | buffer[4]);
+      }
+      else if (size != 1) {
+        break;
+      }
+      const sensor_link_stats &link = sensorLinkStats();
+      sensorLinkReply[0] = 15;
+      sensorLinkReply[1] = accepted;
+      sensorLinkReply[2] = (sensorLinkPeriod() >> 8) & 0xFF;
+      sensorLinkReply[3] = sensorLinkPeriod() & 0xFF;
+      sensorLinkReply[4] = (sensorLinkIntegration() >> 8) & 0xFF;
+      sensorLinkReply[5] = sensorLinkIntegration() & 0xFF;
+      putBigEndian32(&sensorLinkReply[6], link.samples);
+      putBigEndian32(&sensorLinkReply[10], link.badFrames);
+      putBigEndian32(&sensorLinkReply[14], link.lost);
+      putBigEndian32(&sensorLinkReply[18], link.early);
+      putBigEndian32(&sensorLinkReply[22], link.pauses);
+      putBigEndian32(&sensorLinkReply[26], link.timeouts);
+      packetSerialOnion.send(sensorLinkReply, sizeof(sensorLinkReply));
+      break;
+    }
+
     case 0xFF:
       BMS.shutdown();
       break;
@@ -67,13 +360,12 @@ void onPacketReceivedOnion(const uint8_t* buffer, size_t size) {
 }
 
 void onPacketReceivedSensor(const uint8_t* buffer, size_t size) {
-  if(size == 8) {
-    for(int i=0; i<8; i++){
-      rgbc[i] = buffer[i];
-    }
+  unsigned long now = millis();
+  if(sensorLinkReceive(buffer, size, now)) {
+    memcpy(rgbc, buffer, COLOR_SAMPLE_SIZE);
+    rgbcSampleTime = now;
+    colorUpdate(rgbc);
   }
-  /* for whatever reason, this once cycle pause is need to operate */
-  __asm__("nop\n\t"); 
 }
 
 void setup() {
@@ -88,10 +380,11 @@ void setup() {
   Serial3.begin(500000);
   packetSerialSensor.setStream(&Serial3);
   packetSerialSensor.setPacketHandler(&onPacketReceivedSensor);
+  sensorLinkSetup(sendSensor);
 
   // put your setup code here, to run once:
   Serial.begin(115200);
-  Serial.println("Color View Test!");
+  logEvent(LOG_BOOT);
 
   pinMode(ledPin, OUTPUT);
   digitalWrite(ledPin, ledState);
@@ -101,21 +394,33 @@ void setup() {
   Wire.begin(I2C_MASTER, 0x0, I2C_PINS_18_19, I2C_PULLUP_EXT, 100000);
   
   // BMS Setup
-  BMS.begin(&Wire, BMS_ALERT_PIN, BMS_BOOT_PIN);
-  BMS.setTemperatureLimits(-20, 45, 0, 45);
-  BMS.setShuntResistorValue(9); // value in mOhms
-  BMS.setShortCircuitProtection(14000, 200);  // delay in us
-  // BMS.setOvercurrentChargeProtection(8000, 200);  // delay in ms
-  BMS.setOvercurrentDischargeProtection(8000, 320); // delay in ms
-  BMS.setCellUndervoltageProtection(3000, 4); // delay in s
-  BMS.setCellOvervoltageProtection(4400, 2);  // delay in s
-
-  BMS.setBalancingThresholds(0, 4200, 20);  // minIdleTime_min, minCellV_mV, maxVoltageDiff_mV
-  BMS.setIdleCurrentThreshold(100);
+  logEvent(LOG_BMS_BEGIN, BMS.begin(&Wire, BMS_ALERT_PIN, BMS_BOOT_PIN));
+  // stored settings, the defaults in bmsConfig.cpp if there are none
+  int configResult = applyBmsConfig(configLoad());
+  if (configResult == CONFIG_INVALID) {
+    configResult = applyBmsConfig(configDefault);
+  }
   BMS.enableAutoBalancing();
-  BMS.enableDischarging();
+
+  // soft warnings, reported as they change instead of being polled
+  BMS.setWarningBand(WARN_CELL_LOW, 3300, 50);          // mV, hysteresis mV
+  BMS.setWarningBand(WARN_CELL_HIGH, 4150, 30);
+  BMS.setWarningBand(WARN_CHARGE_CURRENT, 6000, 500);   // mA
+  BMS.setWarningBand(WARN_DISCHARGE_CURRENT, 7000, 500);
+  BMS.setWarningBand(WARN_TEMP_LOW, 50, 20);            // °C/10
+  BMS.setWarningBand(WARN_TEMP_HIGH, 400, 20);
+  if (configResult == CONFIG_OK) {
+    BMS.enableDischarging();
+  }
+  bmsPoller.addPack(&BMS);
+
+  healthSetup(BMS_DESIGN_CAPACITY_MAH, 3000, 4200);  // design mAh, empty_mV, full_mV
+  journalSetup();
 
   rgbSetup();
+  batteryLedsSetRange(3000, 4200);  // empty_mV, full_mV of the lowest cell
+  rgbAddStrip(0, RGB_LEDS_PER_STRIP, batteryLevelEffect, 50);
+  rgbAddStrip(1, BMS_NUM_CELLS, cellHeatmapEffect, 25);
 }
 
 void loop() {
@@ -132,9 +437,8 @@ void loop() {
     timer_state.prev_systime = timer_state.systime;
     interrupts();
 
-    if(timer_state.systime % 2 == 0){
-      rgbUpdate();
-    }
+    rgbUpdate();  // frame rate is set with rgbSetFrameRate()
+    sensorLinkUpdate(Serial3.available(), millis());  // pauses the sensor while we are behind
 
     if(timer_state.systime % 50 == 0) {
       // Status LED
@@ -142,10 +446,42 @@ void loop() {
       digitalWrite(ledPin, ledState);
     }
 
-    if(timer_state.systime % 25 == 0) {
-      BMS.update();
+    // each pack is updated every 250ms, BMS is pack 0
+    if(bmsPoller.tick() & 0x01) {
+      bmsSampleTime = millis();
+      batteryLedsUpdate(BMS);
+      healthUpdate(BMS);
+      journalUpdate(BMS);
+
+      uint8_t changes = BMS.getWarningChanges();
+      if (changes != 0) {
+        int temp;
+        warningEvent[0] = 9;
+        warningEvent[1] = BMS.getWarningStatus();
+        warningEvent[2] = changes;
+        temp = BMS.getMinCellVoltage();
+        warningEvent[3] = (temp >> 8) & 0xFF;
+        warningEvent[4] = temp & 0xFF;
+        temp = BMS.getMaxCellVoltage();
+        warningEvent[5] = (temp >> 8) & 0xFF;
+        warningEvent[6] = temp & 0xFF;
+        temp = BMS.getBatteryCurrent();
+        warningEvent[7] = (temp >> 8) & 0xFF;
+        warningEvent[8] = temp & 0xFF;
+        sendTelemetry(warningEvent, 9, bmsSampleTime);
+      }
     }
 
+    if(timer_state.systime % CONFIG_RETRY_TICKS == 0 && !BMS.protectionVerified()) {
+      if (applyBmsConfig(bmsConfig) == CONFIG_OK) {
+        BMS.enableDischarging();
+      }
+    }
+
+    // again after the I2C and EEPROM work above, a slow bus can take longer
+    // than the sensor link buffer lasts
+    sensorLinkUpdate(Serial3.available(), millis());
+
     if(timer_state.systime % 50 == 0){
       int temp;
 
@@ -155,6 +491,7 @@ void loop() {
       temp = BMS.getBatteryCurrent();
       battCurrent[0] = (temp >> 8) & 0xFF;
       battCurrent[1] = (temp) & 0xFF;
+      battSampleTime = bmsSampleTime;
     }
   }
   /*
@@ -164,5 +501,7 @@ void loop() {
   else {
     packetSerialOnion.update();
     packetSerialSensor.update();
+    logDrain();
+    journalFlush();
   }
 }
\ No newline at end of file
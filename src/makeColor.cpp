@@ -41,5 +41,41 @@ int makeColor(unsigned int hue, unsigned int saturation, unsigned int lightness)
 	return (red << 16) | (green << 8) | blue;
 }
 
+// Divide-free version of makeColor() for per-frame use
+//
+// Same arguments as makeColor(), result is within +-1 per channel of it.
+// The divisions by 600000 and 100 are replaced by a multiply and a shift:
+// h2rgb() returns at most 600000, and 600000 * 7131 still fits in 32 bits.
+//
+#define H2RGB_SCALE		7131	// ceil(255 * 2^24 / 600000)
+#define H2RGB_SHIFT		24
+#define LIGHT_SCALE		167117	// ceil(255 * 2^16 / 100)
+#define LIGHT_SHIFT		16
+
+int makeColorFast(unsigned int hue, unsigned int saturation, unsigned int lightness)
+{
+	unsigned int red, green, blue;
+	unsigned int var1, var2;
+
+	if (hue > 359) hue %= 360;
+	if (saturation > 100) saturation = 100;
+	if (lightness > 100) lightness = 100;
+
+	if (saturation == 0) {
+		red = green = blue = (lightness * LIGHT_SCALE) >> LIGHT_SHIFT;
+	} else {
+		if (lightness < 50) {
+			var2 = lightness * (100 + saturation);
+		} else {
+			var2 = ((lightness + saturation) * 100) - (saturation * lightness);
+		}
+		var1 = lightness * 200 - var2;
+		red = (h2rgb(var1, var2, (hue < 240) ? hue + 120 : hue - 240) * H2RGB_SCALE) >> H2RGB_SHIFT;
+		green = (h2rgb(var1, var2, hue) * H2RGB_SCALE) >> H2RGB_SHIFT;
+		blue = (h2rgb(var1, var2, (hue >= 120) ? hue - 120 : hue + 240) * H2RGB_SCALE) >> H2RGB_SHIFT;
+	}
+	return (red << 16) | (green << 8) | blue;
+}
+
 // alternate code:
 // http://forum.pjrc.com/threads/16469-looking-for-ideas-on-generating-RGB-colors-from-accelerometer-gyroscope?p=37170&viewfull=1#post37170
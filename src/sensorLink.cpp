@@ -0,0 +1,148 @@
+#include "sensorLink.h"
+#include "colorSensor.h"
+#include "logRing.h"
+
+static void (*sendControl)(const uint8_t *buffer, size_t size) = NULL;
+static sensor_link_stats stats;
+
+static uint16_t period = SENSOR_DEFAULT_PERIOD_MS;
+static uint16_t integration = SENSOR_DEFAULT_INTEGRATION_MS;
+static bool paused = false;
+static bool sequenced = false;            // a sequence number was seen
+static uint8_t nextSequence = 0;
+static bool silent = false;               // timed out, not heard from since
+static bool windowOpen = false;          // rate window started by a sample
+static unsigned long windowStart = 0;
+static uint16_t windowSamples = 0;        // samples after the one at windowStart
+static unsigned long lastHeard = 0;       // last sample or resume
+static unsigned long lastControl = 0;
+
+static void sendConfig() {
+  uint8_t frame[5];
+  frame[0] = SENSOR_CTRL_CONFIG;
+  frame[1] = (period >> 8) & 0xFF;
+  frame[2] = period & 0xFF;
+  frame[3] = (integration >> 8) & 0xFF;
+  frame[4] = integration & 0xFF;
+  sendControl(frame, sizeof(frame));
+}
+
+static void sendFlow(bool run) {
+  uint8_t frame[2] = { SENSOR_CTRL_FLOW, run };
+  sendControl(frame, sizeof(frame));
+}
+
+void sensorLinkSetup(void (*send)(const uint8_t *buffer, size_t size)) {
+  sendControl = send;
+  sendConfig();
+  colorSetIntegrationTime(integration);
+  sendFlow(1);
+  lastHeard = millis();
+  lastControl = lastHeard;
+}
+
+bool sensorLinkConfigure(uint16_t period_ms, uint16_t integration_ms) {
+  if (period_ms < SENSOR_MIN_PERIOD_MS || integration_ms == 0 || integration_ms > period_ms) {
+    return 0;
+  }
+  period = period_ms;
+  integration = integration_ms;
+  colorSetIntegrationTime(integration);
+  windowOpen = false;
+  if (sendControl != NULL) {
+    sendConfig();
+  }
+  return 1;
+}
+
+uint16_t sensorLinkPeriod() {
+  return period;
+}
+
+uint16_t sensorLinkIntegration() {
+  return integration;
+}
+
+bool sensorLinkReceive(const uint8_t *buffer, size_t size, unsigned long now) {
+  if (size != COLOR_SAMPLE_SIZE && size != COLOR_SAMPLE_SIZE + 1) {
+    stats.badFrames++;
+    return 0;
+  }
+
+  if (size == COLOR_SAMPLE_SIZE + 1) {
+    uint8_t sequence = buffer[COLOR_SAMPLE_SIZE];
+    if (sequenced) {
+      stats.lost += (uint8_t)(sequence - nextSequence);
+    }
+    nextSequence = sequence + 1;
+    sequenced = true;
+  }
+
+  // Over-sampling is judged from the rate over a long window. The time
+  // between two samples says nothing when they were drained from the
+  // buffer together after a long tick.
+  stats.samples++;
+  if (!windowOpen) {
+    windowOpen = true;
+    windowStart = now;
+    windowSamples = 0;
+  }
+  else {
+    windowSamples++;
+    unsigned long elapsed = now - windowStart;
+    if (elapsed >= (unsigned long)period * SENSOR_RATE_WINDOW_PERIODS) {
+      unsigned long allowed = elapsed * 4 / (3 * (unsigned long)period);
+      if (windowSamples > allowed) {
+        stats.early += windowSamples - allowed;
+      }
+      windowStart = now;
+      windowSamples = 0;
+    }
+  }
+  lastHeard = now;
+  silent = false;
+  return 1;
+}
+
+void sensorLinkUpdate(int rxWaiting, unsigned long now) {
+  if (sendControl == NULL) {
+    return;
+  }
+
+  if (!paused && rxWaiting >= SENSOR_RX_HIGH_WATER) {
+    sendFlow(0);
+    paused = true;
+    stats.pauses++;
+    return;
+  }
+  if (paused) {
+    if (rxWaiting <= SENSOR_RX_LOW_WATER) {
+      sendFlow(1);
+      paused = false;
+      lastHeard = now;    // a paused sensor sends nothing, restart the timeout
+    }
+    return;
+  }
+
+  // nothing for several periods: configuration or resume lost, or the
+  // sensor restarted
+  unsigned long timeout = (unsigned long)period * SENSOR_TIMEOUT_PERIODS;
+  if (now - lastHeard > timeout && now - lastControl > timeout) {
+    sendConfig();
+    sendFlow(1);
+    lastControl = now;
+    stats.timeouts++;
+    // a restarted sensor counts from its own start, that is no loss
+    sequenced = false;
+    windowOpen = false;
+    // once per outage, a missing sensor would flood the log
+    if (!silent) {
+      logEvent(LOG_SENSOR_TIMEOUT, stats.timeouts & 0x7FFF, period);
+      silent = true;
+    }
+  }
+}
+
+const sensor_link_stats &sensorLinkStats() {
+  return stats;
+}
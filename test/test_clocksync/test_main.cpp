@@ -0,0 +1,57 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "clockSync.h"
+
+#define HOST_DRIFT_PPM 150
+#define HOST_EPOCH     123456789L
+
+// Host clock HOST_DRIFT_PPM fast against millis()
+static uint32_t hostClock(unsigned long local_ms) {
+  return HOST_EPOCH + local_ms + (uint32_t)((int64_t)local_ms * HOST_DRIFT_PPM / 1000000);
+}
+
+void test_unsynced_passes_millis(void) {
+  TEST_ASSERT_FALSE(clockSynced());
+  TEST_ASSERT_EQUAL_UINT32(4321, clockHostTime(4321));
+}
+
+// A sync every 10 s for 3 h, each request delayed by 0..3 ms on the link.
+// After the first hour the drift stays near the true rate and stamps 5 s
+// after a sync are within a few ms of the host clock.
+void test_converges_on_host_drift(void) {
+  long driftSum = 0;
+  int settled = 0, worstDrift = 0, worstError = 0;
+
+  srand(1);
+  for (unsigned long t = 1000; t < 3 * 3600000UL; t += 10000) {
+    clockSyncUpdate(hostClock(t) - rand() % 4, 0, t);
+    if (t < 3600000UL) {
+      continue;
+    }
+
+    int drift = clockDrift() - HOST_DRIFT_PPM;
+    int error = (int32_t)(clockHostTime(t + 5000) - hostClock(t + 5000));
+    driftSum += drift;
+    settled++;
+    if (abs(drift) > abs(worstDrift))
+      worstDrift = drift;
+    if (abs(error) > abs(worstError))
+      worstError = error;
+  }
+
+  char message[64];
+  snprintf(message, sizeof(message), "mean drift error %ld ppm", driftSum / settled);
+  TEST_ASSERT_TRUE(clockSynced());
+  TEST_ASSERT_TRUE_MESSAGE(labs(driftSum / settled) <= 3, message);
+  TEST_ASSERT_INT_WITHIN(20, 0, worstDrift);
+  TEST_ASSERT_INT_WITHIN(4, 0, worstError);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_unsynced_passes_millis);
+  RUN_TEST(test_converges_on_host_drift);
+  return UNITY_END();
+}
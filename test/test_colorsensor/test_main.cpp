@@ -0,0 +1,146 @@
+#include <unity.h>
+#include <math.h>
+
+#include "colorSensor.h"
+
+static void packSample(uint8_t *sample, long r, long g, long b, long c) {
+  long channels[4] = { r, g, b, c };
+  for (int i = 0; i < 4; i++) {
+    sample[2*i] = (channels[i] >> 8) & 0xFF;
+    sample[2*i+1] = channels[i] & 0xFF;
+  }
+}
+
+// Raw counts the default calibration maps to XYZ, clear as the sum
+static void synthesize(uint8_t *sample, double X, double Y, double Z) {
+  double m[9];
+  for (int i = 0; i < 9; i++) {
+    m[i] = colorDefaultCalibration.matrix[i] / 4096.0;
+  }
+  double det = m[0] * (m[4]*m[8] - m[5]*m[7]) - m[1] * (m[3]*m[8] - m[5]*m[6]) +
+    m[2] * (m[3]*m[7] - m[4]*m[6]);
+  double inverse[9] = {
+    (m[4]*m[8] - m[5]*m[7]) / det, (m[2]*m[7] - m[1]*m[8]) / det, (m[1]*m[5] - m[2]*m[4]) / det,
+    (m[5]*m[6] - m[3]*m[8]) / det, (m[0]*m[8] - m[2]*m[6]) / det, (m[2]*m[3] - m[0]*m[5]) / det,
+    (m[3]*m[7] - m[4]*m[6]) / det, (m[1]*m[6] - m[0]*m[7]) / det, (m[0]*m[4] - m[1]*m[3]) / det };
+  long rgb[3];
+  for (int i = 0; i < 3; i++) {
+    rgb[i] = lround(inverse[3*i] * X + inverse[3*i+1] * Y + inverse[3*i+2] * Z);
+  }
+  packSample(sample, rgb[0], rgb[1], rgb[2], rgb[0] + rgb[1] + rgb[2]);
+}
+
+// Chromaticity, lux and CCT against the float computation
+static void checkIlluminant(double X, double Y, double Z) {
+  uint8_t sample[COLOR_SAMPLE_SIZE];
+  synthesize(sample, X, Y, Z);
+  colorUpdate(sample);
+  const color_result &result = colorResult();
+
+  double x = X / (X + Y + Z);
+  double y = Y / (X + Y + Z);
+  double n = (x - 0.3320) / (0.1858 - y);
+  double cct = 449 * n*n*n + 3525 * n*n + 6823.3 * n + 5520.33;
+
+  TEST_ASSERT_EQUAL_UINT8(COLOR_VALID, result.flags);
+  TEST_ASSERT_INT_WITHIN(7, lround(x * 65536), result.x);     // 0.0001
+  TEST_ASSERT_INT_WITHIN(7, lround(y * 65536), result.y);
+  TEST_ASSERT_INT_WITHIN(1, lround(Y), (long)result.lux);
+  TEST_ASSERT_INT_WITHIN(5, lround(cct), result.cct);
+}
+
+void test_d65(void) {
+  checkIlluminant(950.47, 1000, 1088.83);
+}
+
+void test_illuminant_a(void) {
+  checkIlluminant(109.85 * 50, 100 * 50, 35.585 * 50);
+}
+
+void test_d50(void) {
+  checkIlluminant(96.42 * 20, 100 * 20, 82.51 * 20);
+}
+
+void test_dark(void) {
+  uint8_t sample[COLOR_SAMPLE_SIZE];
+  packSample(sample, 5, 5, 4, COLOR_MIN_CLEAR - 1);
+  colorUpdate(sample);
+  TEST_ASSERT_EQUAL_UINT8(COLOR_DARK, colorResult().flags);
+  TEST_ASSERT_EQUAL_UINT16(0, colorResult().cct);
+}
+
+// 1024 counts per 2.4 ms cycle, 16 bit from 64 cycles on
+void test_saturation_follows_integration(void) {
+  TEST_ASSERT_EQUAL_UINT16(COLOR_MAX_COUNT, colorSaturation());
+  colorSetIntegrationTime(50);
+  TEST_ASSERT_EQUAL_UINT16(20 * 1024, colorSaturation());
+  colorSetIntegrationTime(1);
+  TEST_ASSERT_EQUAL_UINT16(1024, colorSaturation());
+  colorSetIntegrationTime(154);
+  TEST_ASSERT_EQUAL_UINT16(COLOR_MAX_COUNT, colorSaturation());
+
+  uint8_t sample[COLOR_SAMPLE_SIZE];
+  colorSetIntegrationTime(24);
+  packSample(sample, 3000, 3000, 3000, 10 * 1024 - 1);
+  colorUpdate(sample);
+  TEST_ASSERT_BITS_LOW(COLOR_SATURATED, colorResult().flags);
+  packSample(sample, 3500, 3500, 3500, 10 * 1024);
+  colorUpdate(sample);
+  TEST_ASSERT_BITS_HIGH(COLOR_SATURATED, colorResult().flags);
+  colorSetIntegrationTime(COLOR_LUX_INTEGRATION_MS);
+}
+
+// The same scene at twice the integration time gives twice the counts
+void test_lux_independent_of_integration(void) {
+  uint8_t sample[COLOR_SAMPLE_SIZE];
+  long scale[2] = { 1, 2 };
+  uint16_t integration_ms[2] = { 50, 100 };
+  uint32_t lux[2];
+
+  for (int i = 0; i < 2; i++) {
+    colorSetIntegrationTime(integration_ms[i]);
+    synthesize(sample, 95.047 * scale[i], 100 * scale[i], 108.883 * scale[i]);
+    colorUpdate(sample);
+    lux[i] = colorResult().lux;
+  }
+  colorSetIntegrationTime(COLOR_LUX_INTEGRATION_MS);
+
+  TEST_ASSERT_INT_WITHIN(1, 100, (long)lux[0]);
+  TEST_ASSERT_INT_WITHIN(1, (long)lux[0], (long)lux[1]);
+}
+
+// A channel that is all of X + Y + Z reads 1.0, not 65536 wrapped to 0
+void test_pure_channel_chromaticity(void) {
+  const color_calibration identity = {
+    { 4096, 0, 0,
+      0, 4096, 0,
+      0, 0, 4096 },
+    256
+  };
+  uint8_t sample[COLOR_SAMPLE_SIZE];
+  colorSetCalibration(identity);
+
+  packSample(sample, 1000, 0, 0, 1000);
+  colorUpdate(sample);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, colorResult().x);
+  TEST_ASSERT_EQUAL_UINT16(0, colorResult().y);
+
+  packSample(sample, 0, 1000, 0, 1000);
+  colorUpdate(sample);
+  TEST_ASSERT_EQUAL_UINT16(0, colorResult().x);
+  TEST_ASSERT_EQUAL_UINT16(0xFFFF, colorResult().y);
+
+  colorSetCalibration(colorDefaultCalibration);
+}
+
+int main(int argc, char **argv) {
+  UNITY_BEGIN();
+  RUN_TEST(test_d65);
+  RUN_TEST(test_illuminant_a);
+  RUN_TEST(test_d50);
+  RUN_TEST(test_dark);
+  RUN_TEST(test_saturation_follows_integration);
+  RUN_TEST(test_lux_independent_of_integration);
+  RUN_TEST(test_pure_channel_chromaticity);
+  return UNITY_END();
+}
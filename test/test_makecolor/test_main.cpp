@@ -0,0 +1,61 @@
+#include <unity.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "makeColor.h"
+
+static int channelError(int a, int b, int shift) {
+  return abs(((a >> shift) & 0xFF) - ((b >> shift) & 0xFF));
+}
+
+// Every hue, saturation and lightness in range, each channel within +-1
+void test_fast_matches_reference(void) {
+  unsigned long mismatches = 0;
+  int firstHue = -1, firstSat = -1, firstLight = -1;
+
+  for (unsigned int hue = 0; hue < 360; hue++) {
+    for (unsigned int sat = 0; sat <= 100; sat++) {
+      for (unsigned int light = 0; light <= 100; light++) {
+        int ref = makeColor(hue, sat, light);
+        int fast = makeColorFast(hue, sat, light);
+        if (channelError(ref, fast, 16) > 1 || channelError(ref, fast, 8) > 1 ||
+            channelError(ref, fast, 0) > 1)
+        {
+          if (mismatches++ == 0) {
+            firstHue = hue;
+            firstSat = sat;
+            firstLight = light;
+          }
+        }
+      }
+    }
+  }
+
+  char message[64];
+  snprintf(message, sizeof(message), "first at hue %d sat %d light %d", firstHue, firstSat, firstLight);
+  TEST_ASSERT_EQUAL_UINT32_MESSAGE(0, mismatches, message);
+}
+
+static void assertClose(int ref, int fast) {
+  TEST_ASSERT_TRUE(channelError(ref, fast, 16) <= 1);
+  TEST_ASSERT_TRUE(channelError(ref, fast, 8) <= 1);
+  TEST_ASSERT_TRUE(channelError(ref, fast, 0) <= 1);
+}
+
+// Out of range arguments are wrapped or clamped like makeColor() does,
+// a huge hue takes one modulo, not a loop
+void test_fast_wraps_and_clamps(void) {
+  TEST_ASSERT_EQUAL_INT(makeColorFast(15, 80, 40), makeColorFast(15 + 360 * 7, 80, 40));
+  TEST_ASSERT_EQUAL_INT(makeColorFast(200, 100, 100), makeColorFast(200, 250, 250));
+  assertClose(makeColor(0xFFFFFFFFu, 70, 60), makeColorFast(0xFFFFFFFFu, 70, 60));
+  assertClose(makeColor(1000000, 101, 30), makeColorFast(1000000, 101, 30));
+}
+
+int main(int argc, char **argv) {
+  (void)argc;
+  (void)argv;
+  UNITY_BEGIN();
+  RUN_TEST(test_fast_matches_reference);
+  RUN_TEST(test_fast_wraps_and_clamps);
+  return UNITY_END();
+}
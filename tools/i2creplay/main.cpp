@@ -0,0 +1,181 @@
+/*
+ * i2creplay - analyses I2C transaction captures of the bq769x0 driver
+ *
+ * Reads the frames sent by traceSend() (Onion command 8, or packsim -t)
+ * and replays the transactions on a model of the bus timing to report bus
+ * occupancy, transfers per driver method and update pass, and redundant
+ * reads: registers read again in the same update pass with the same value
+ * and no write in between.
+ *
+ * It does not replay a capture against the driver. A record keeps only a
+ * CRC-8 of the data of block reads, so the register contents the driver
+ * saw (cell voltages, coulomb counter) cannot be rebuilt from it. Feeding
+ * the driver needs the full data, which at 2 * 14 bytes per cell block
+ * read would not fit the 256 byte ring. To run the driver against
+ * repeatable bus traffic, use packsim with a fixed seed instead.
+ *
+ * Build and run: pio run -e i2creplay && .pio/build/i2creplay/program capture.bin
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <map>
+#include <tuple>
+
+#include "i2cTrace.h"
+
+static const char *callerNames[TRACE_CALLERS] = {
+  "other", "begin", "status", "current", "cells", "pack", "temperatures",
+  "balancing", "config", "fets"
+};
+
+typedef struct {
+  unsigned long transfers;
+  unsigned long failed;
+  unsigned long bytes;
+  double        bus_us;
+  unsigned long redundant;
+} caller_stats;
+
+typedef struct {
+  uint8_t data;
+  bool    written;      // written since the last read in this pass
+} last_read;
+
+// Bytes on the bus including address, register pointer and CRC bytes
+static unsigned int transferBytes(const i2c_trace_record &rec) {
+  if ((rec.flags & TRACE_OP_MASK) == TRACE_WRITE) {
+    return 2 + 2 * rec.length;
+  }
+  return 3 + 2 * rec.length;    // pointer write, repeated start, read
+}
+
+// 9 clocks per byte plus start, repeated start and stop conditions
+static double transferTime_us(const i2c_trace_record &rec) {
+  unsigned long clock = ((rec.flags >> TRACE_CLOCK_SHIFT) & 0x07) * 100000UL;
+  if (clock == 0) {
+    clock = 100000;
+  }
+  unsigned int conditions = ((rec.flags & TRACE_OP_MASK) == TRACE_WRITE) ? 2 : 3;
+  return (transferBytes(rec) * 9 + conditions) * 1e6 / clock;
+}
+
+int main(int argc, char **argv) {
+  if (argc != 2) {
+    fprintf(stderr, "usage: %s capture.bin\n", argv[0]);
+    return 1;
+  }
+  FILE *file = fopen(argv[1], "rb");
+  if (file == NULL) {
+    perror(argv[1]);
+    return 1;
+  }
+
+  caller_stats stats[TRACE_CALLERS];
+  memset(stats, 0, sizeof(stats));
+  std::map<std::tuple<int, int, int>, last_read> passReads;   // address, register, length
+  std::map<std::tuple<int, int>, unsigned long> redundantRegisters;  // caller, register
+  unsigned long records = 0;
+  unsigned long lost = 0;
+  unsigned long passes = 0;
+  unsigned long long time_ms = 0;     // unwrapped
+  unsigned long long firstTime_ms = 0;
+  uint16_t previousTime = 0;
+  double bus_us = 0;
+
+  uint8_t header[5];
+  while (fread(header, 1, sizeof(header), file) == sizeof(header)) {
+    if (header[0] != 8 || header[2] > I2C_TRACE_RECORDS_PER_FRAME) {
+      fprintf(stderr, "not a trace frame at offset %ld\n", ftell(file) - (long)sizeof(header));
+      return 1;
+    }
+    if (header[1] == 0) {
+      lost += header[3] | (header[4] << 8);
+    }
+
+    for (uint8_t i = 0; i < header[2]; i++) {
+      i2c_trace_record rec;
+      if (fread(&rec, sizeof(rec), 1, file) != 1) {
+        fprintf(stderr, "truncated frame\n");
+        return 1;
+      }
+      // records are in order and never more than 65 s apart
+      time_ms += (records == 0) ? 0 : (uint16_t)(rec.time - previousTime);
+      previousTime = rec.time;
+      if (records == 0) {
+        firstTime_ms = time_ms;
+      }
+      records++;
+
+      uint8_t op = rec.flags & TRACE_OP_MASK;
+      if (op == TRACE_MARK) {
+        passes++;
+        passReads.clear();    // each pass starts over
+        continue;
+      }
+
+      int caller = (rec.caller < TRACE_CALLERS) ? rec.caller : (int)TRACE_OTHER;
+      caller_stats *s = &stats[caller];
+      double t = transferTime_us(rec);
+      s->transfers++;
+      s->bytes += transferBytes(rec);
+      s->bus_us += t;
+      bus_us += t;
+      if (rec.flags & TRACE_FAILED) {
+        s->failed++;
+        continue;
+      }
+
+      if (op == TRACE_WRITE) {
+        for (auto &entry : passReads) {
+          int address = std::get<0>(entry.first);
+          int reg = std::get<1>(entry.first);
+          int length = std::get<2>(entry.first);
+          if (address == rec.address && reg < rec.reg + rec.length && rec.reg < reg + length) {
+            entry.second.written = true;
+          }
+        }
+        continue;
+      }
+
+      auto key = std::make_tuple((int)rec.address, (int)rec.reg, (int)rec.length);
+      auto previous = passReads.find(key);
+      if (previous != passReads.end() && !previous->second.written &&
+        previous->second.data == rec.data)
+      {
+        s->redundant++;
+        redundantRegisters[std::make_tuple(caller, (int)rec.reg)]++;
+      }
+      passReads[key] = { rec.data, false };
+    }
+  }
+  fclose(file);
+
+  double span_s = (time_ms - firstTime_ms) / 1000.0;
+  printf("%lu records, %lu lost, %lu update passes, %.1f s\n", records, lost, passes, span_s);
+  if (span_s > 0) {
+    printf("bus occupancy %.2f %% (%.1f ms busy)\n", bus_us / 10000.0 / span_s, bus_us / 1000);
+  }
+
+  printf("\n%-13s %9s %7s %9s %10s %9s %10s\n", "caller", "transfers", "failed",
+    "bytes", "bus ms", "per pass", "redundant");
+  for (int i = 0; i < TRACE_CALLERS; i++) {
+    caller_stats *s = &stats[i];
+    if (s->transfers == 0) {
+      continue;
+    }
+    printf("%-13s %9lu %7lu %9lu %10.1f %9.2f %10lu\n", callerNames[i], s->transfers,
+      s->failed, s->bytes, s->bus_us / 1000, passes ? (double)s->transfers / passes : 0,
+      s->redundant);
+  }
+
+  if (!redundantRegisters.empty()) {
+    printf("\nredundant reads (same value, same pass)\n");
+    for (auto &entry : redundantRegisters) {
+      printf("  %-13s register 0x%02x  %lu\n", callerNames[std::get<0>(entry.first)],
+        std::get<1>(entry.first), entry.second);
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,152 @@
+/*
+ * ledbench - renders the LED effects on the host and measures their cost
+ *
+ * Runs rgbUpdate() once per virtual 10ms tick with the OctoWS2811 stand-in,
+ * times every effect call and every rgbUpdate(), and optionally writes each
+ * shown frame as a binary PPM image (one row per output) to a single file.
+ * View with e.g. `ffmpeg -f image2pipe -i frames.ppm -vf scale=400:160 out.gif`.
+ *
+ * Build and run: pio run -e ledbench && .pio/build/ledbench/program -n 1000
+ */
+
+#include <Arduino.h>
+#include <OctoWS2811.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <unistd.h>
+
+#include "RGBleds.h"
+
+typedef std::chrono::steady_clock bench_clock;
+
+typedef struct {
+  const char     *name;
+  rgb_effect      effect;
+  unsigned long   calls;
+  double          total_ns;
+  double          max_ns;
+} effect_stats;
+
+effect_stats stats[RGB_MAX_STRIPS];
+FILE *frameFile = NULL;
+unsigned long framesWritten = 0;
+
+// Hue sweep recomputed per pixel and frame with the divide-free kernel
+void hueSweepEffect(uint8_t output, uint8_t length, unsigned long frame) {
+  for (uint8_t i = 0; i < length; i++) {
+    rgbSetStripPixel(output, i, makeColorFast(frame * 3 + i * 18, 100, 50));
+  }
+}
+
+// Never changes, exercises the skip-unchanged path
+void staticEffect(uint8_t output, uint8_t length, unsigned long frame) {
+  (void)frame;
+  for (uint8_t i = 0; i < length; i++) {
+    rgbSetStripPixel(output, i, 0x202020);
+  }
+}
+
+// Slow fade, exercises the dithering path at low levels
+void fadeEffect(uint8_t output, uint8_t length, unsigned long frame) {
+  uint8_t level = (frame & 0x100) ? ~frame : frame;
+  for (uint8_t i = 0; i < length; i++) {
+    rgbSetStripPixel(output, i, rgbScale(0x4080FF, level));
+  }
+}
+
+// Registered with the renderer instead of the real effect to time it
+void timedEffect(uint8_t output, uint8_t length, unsigned long frame) {
+  effect_stats *s = &stats[output];
+  bench_clock::time_point start = bench_clock::now();
+  s->effect(output, length, frame);
+  double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+  s->calls++;
+  s->total_ns += ns;
+  if (ns > s->max_ns) {
+    s->max_ns = ns;
+  }
+}
+
+void writeFrame(const int *frame, uint32_t numPerStrip) {
+  if (frameFile == NULL) {
+    return;
+  }
+  fprintf(frameFile, "P6\n%u %u\n255\n", (unsigned)numPerStrip, RGB_MAX_STRIPS);
+  for (uint32_t i = 0; i < numPerStrip * RGB_MAX_STRIPS; i++) {
+    fputc((frame[i] >> 16) & 0xFF, frameFile);
+    fputc((frame[i] >> 8) & 0xFF, frameFile);
+    fputc(frame[i] & 0xFF, frameFile);
+  }
+  framesWritten++;
+}
+
+void addStrip(uint8_t output, const char *name, rgb_effect effect, uint8_t fps) {
+  stats[output].name = name;
+  stats[output].effect = effect;
+  rgbAddStrip(output, RGB_LEDS_PER_STRIP, timedEffect, fps);
+}
+
+int main(int argc, char **argv) {
+  unsigned long ticks = 1000;
+  int brightness = 255;
+  bool dither = false;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:o:b:d")) != -1) {
+    switch (opt) {
+      case 'n': ticks = strtoul(optarg, NULL, 0); break;
+      case 'b': brightness = atoi(optarg); break;
+      case 'd': dither = true; break;
+      case 'o':
+        frameFile = fopen(optarg, "wb");
+        if (frameFile == NULL) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n ticks] [-o frames.ppm] [-b brightness] [-d]\n", argv[0]);
+        return 1;
+    }
+  }
+
+  OctoWS2811::showHook = writeFrame;
+  rgbSetup();
+  rgbSetBrightness(brightness);
+  rgbSetDithering(dither);
+  addStrip(0, "rainbow", rgbRainbowEffect, 50);
+  addStrip(1, "hueSweep", hueSweepEffect, 100);
+  addStrip(2, "static", staticEffect, 25);
+  addStrip(3, "fade", fadeEffect, 100);
+
+  double updateTotal_ns = 0;
+  double updateMax_ns = 0;
+  for (unsigned long t = 0; t < ticks; t++) {
+    nativeAdvanceMillis(1000 / RGB_TICK_HZ);
+    bench_clock::time_point start = bench_clock::now();
+    rgbUpdate();
+    double ns = std::chrono::duration<double, std::nano>(bench_clock::now() - start).count();
+    updateTotal_ns += ns;
+    if (ns > updateMax_ns) {
+      updateMax_ns = ns;
+    }
+  }
+
+  printf("%-10s %8s %10s %10s\n", "effect", "calls", "avg ns", "max ns");
+  for (uint8_t i = 0; i < RGB_MAX_STRIPS; i++) {
+    if (stats[i].calls != 0) {
+      printf("%-10s %8lu %10.0f %10.0f\n", stats[i].name, stats[i].calls,
+        stats[i].total_ns / stats[i].calls, stats[i].max_ns);
+    }
+  }
+  printf("%-10s %8lu %10.0f %10.0f\n", "rgbUpdate", ticks,
+    ticks ? updateTotal_ns / ticks : 0, updateMax_ns);
+  printf("frames shown %lu, skipped %lu, strips deferred %lu\n",
+    rgbFramesShown(), rgbFramesSkipped(), rgbStripsDeferred());
+  if (frameFile != NULL) {
+    fclose(frameFile);
+    printf("%lu frames written\n", framesWritten);
+  }
+  return 0;
+}
@@ -0,0 +1,69 @@
+#!/usr/bin/env python3
+"""
+Decode the binary event log written by src/logRing.cpp.
+
+Usage:
+    stty -F /dev/ttyACM0 raw && python3 tools/logdecode.py /dev/ttyACM0
+    python3 tools/logdecode.py capture.bin
+
+Event names are read from the log_event enum in include/logRing.h.
+"""
+
+import os
+import re
+import struct
+import sys
+
+LOG_SYNC = 0xA5
+FRAME = struct.Struct('<BIBhhB')
+
+HEADER = os.path.join(os.path.dirname(os.path.abspath(__file__)),
+                      '..', 'include', 'logRing.h')
+
+
+def load_event_names(path=HEADER):
+    names = {}
+    with open(path) as f:
+        body = re.search(r'enum\s+log_event\s*{(.*?)}', f.read(), re.S).group(1)
+    for name, value in re.findall(r'(LOG_\w+)\s*=\s*(\d+)', body):
+        names[int(value)] = name
+    return names
+
+
+def frames(stream):
+    buf = bytearray()
+    while True:
+        chunk = stream.read(256)
+        if not chunk:
+            return
+        buf += chunk
+        while len(buf) >= FRAME.size:
+            if buf[0] != LOG_SYNC:
+                del buf[0]
+                continue
+            checksum = 0
+            for b in buf[1:FRAME.size - 1]:
+                checksum ^= b
+            if checksum != buf[FRAME.size - 1]:
+                # Not a real frame start, resynchronize on the next byte
+                del buf[0]
+                continue
+            yield FRAME.unpack(bytes(buf[:FRAME.size]))[1:5]
+            del buf[:FRAME.size]
+
+
+def main():
+    if len(sys.argv) != 2:
+        print(__doc__.strip())
+        return 1
+    names = load_event_names()
+    with open(sys.argv[1], 'rb', buffering=0) as stream:
+        for timestamp, event, arg0, arg1 in frames(stream):
+            name = names.get(event, 'EVENT_%d' % event)
+            print('%10.3f  %-20s %6d %6d' % (timestamp / 1000.0, name, arg0, arg1))
+            sys.stdout.flush()
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,61 @@
+#include "Arduino.h"
+
+#include <chrono>
+
+static unsigned long virtualMillis = 0;
+static const std::chrono::steady_clock::time_point startTime = std::chrono::steady_clock::now();
+
+unsigned long millis() {
+  return virtualMillis;
+}
+
+unsigned long micros() {
+  return std::chrono::duration_cast<std::chrono::microseconds>(
+    std::chrono::steady_clock::now() - startTime).count();
+}
+
+void nativeAdvanceMillis(unsigned long ms) {
+  virtualMillis += ms;
+}
+
+// Delays only move the virtual clock, the host never sleeps
+void delay(unsigned long ms) {
+  virtualMillis += ms;
+}
+
+void delayMicroseconds(unsigned int us) {
+  (void)us;
+}
+
+void noInterrupts() {}
+void interrupts() {}
+
+void pinMode(uint8_t pin, uint8_t mode) {
+  (void)pin;
+  (void)mode;
+}
+
+void digitalWrite(uint8_t pin, uint8_t value) {
+  (void)pin;
+  (void)value;
+}
+
+int digitalPinToInterrupt(uint8_t pin) {
+  return pin;
+}
+
+// digitalPinToInterrupt() is the identity, so interrupt numbers are pins
+static void (*interruptHandlers[64])(void);
+
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode) {
+  (void)mode;
+  if (interrupt < 64) {
+    interruptHandlers[interrupt] = isr;
+  }
+}
+
+void nativeTriggerInterrupt(uint8_t pin) {
+  if (pin < 64 && interruptHandlers[pin] != 0) {
+    interruptHandlers[pin]();
+  }
+}
@@ -0,0 +1,50 @@
+/*
+ * Host stand-in for the parts of the Teensy Arduino core used by the
+ * firmware sources that are shared with the native tools.
+ *
+ * millis() is a virtual clock that the host program advances, so firmware
+ * timing runs as fast as the host can go. micros() is real elapsed time and
+ * measures render and driver cost.
+ */
+
+#ifndef NATIVE_ARDUINO_H
+#define NATIVE_ARDUINO_H
+
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+
+#include "binary.h"
+
+typedef uint8_t byte;
+
+#define HIGH      1
+#define LOW       0
+#define INPUT     0
+#define OUTPUT    1
+#define RISING    3
+
+#define DMAMEM
+#define F(string) string
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+
+void noInterrupts();
+void interrupts();
+
+void pinMode(uint8_t pin, uint8_t mode);
+void digitalWrite(uint8_t pin, uint8_t value);
+int digitalPinToInterrupt(uint8_t pin);
+void attachInterrupt(uint8_t interrupt, void (*isr)(void), int mode);
+
+/* Host side control of the virtual clock */
+void nativeAdvanceMillis(unsigned long ms);
+
+/* Runs the ISR attached to a pin, e.g. when a device model raises ALERT */
+void nativeTriggerInterrupt(uint8_t pin);
+
+#endif // NATIVE_ARDUINO_H
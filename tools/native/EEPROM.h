@@ -0,0 +1,35 @@
+/*
+ * Host stand-in for the Teensy EEPROM library: 128 bytes of RAM that start
+ * out erased (0xFF), like a new Teensy LC.
+ */
+
+#ifndef NATIVE_EEPROM_H
+#define NATIVE_EEPROM_H
+
+#include <stdint.h>
+#include <string.h>
+
+class EEPROMClass {
+public:
+  EEPROMClass() { memset(data, 0xFF, sizeof(data)); }
+
+  uint8_t read(int address) { return data[address]; }
+  void write(int address, uint8_t value) { data[address] = value; }
+  uint16_t length() { return sizeof(data); }
+
+  template <typename T> T &get(int address, T &t) {
+    memcpy(&t, &data[address], sizeof(T));
+    return t;
+  }
+  template <typename T> const T &put(int address, const T &t) {
+    memcpy(&data[address], &t, sizeof(T));
+    return t;
+  }
+
+private:
+  uint8_t data[128];
+};
+
+extern EEPROMClass EEPROM;
+
+#endif // NATIVE_EEPROM_H
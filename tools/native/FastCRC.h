@@ -0,0 +1,26 @@
+/*
+ * Host stand-in for the FastCRC library, only the CRC-8 variant used by the
+ * firmware. Bitwise instead of table driven, speed does not matter here.
+ */
+
+#ifndef NATIVE_FASTCRC_H
+#define NATIVE_FASTCRC_H
+
+#include <stdint.h>
+
+class FastCRC8 {
+public:
+  // CRC-8 as used by SMBus: polynomial 0x07, initial value 0
+  uint8_t smbus(const uint8_t *data, uint16_t datalen) {
+    uint8_t crc = 0;
+    while (datalen--) {
+      crc ^= *data++;
+      for (uint8_t i = 0; i < 8; i++) {
+        crc = (crc & 0x80) ? (uint8_t)((crc << 1) ^ 0x07) : (uint8_t)(crc << 1);
+      }
+    }
+    return crc;
+  }
+};
+
+#endif // NATIVE_FASTCRC_H
@@ -0,0 +1,37 @@
+#include "OctoWS2811.h"
+
+#include <string.h>
+
+void (*OctoWS2811::showHook)(const int *frame, uint32_t numPerStrip) = 0;
+
+// The firmware buffers hold bit-transposed data (6 ints per pixel position),
+// the stand-in keeps one plain color per pixel in its own buffers instead
+OctoWS2811::OctoWS2811(uint32_t numPerStrip, void *frameBuf, void *drawBuf, uint8_t config)
+  : stripLen(numPerStrip), drawBuffer(new int[numPerStrip * 8]), frameBuffer(new int[numPerStrip * 8])
+{
+  (void)frameBuf;
+  (void)drawBuf;
+  (void)config;
+}
+
+void OctoWS2811::begin(void) {
+  memset(drawBuffer, 0, stripLen * 8 * sizeof(int));
+  memset(frameBuffer, 0, stripLen * 8 * sizeof(int));
+}
+
+void OctoWS2811::setPixel(uint32_t num, int color) {
+  if (num < stripLen * 8) {
+    drawBuffer[num] = color;
+  }
+}
+
+int OctoWS2811::getPixel(uint32_t num) {
+  return (num < stripLen * 8) ? drawBuffer[num] : 0;
+}
+
+void OctoWS2811::show(void) {
+  memcpy(frameBuffer, drawBuffer, stripLen * 8 * sizeof(int));
+  if (showHook) {
+    showHook(frameBuffer, stripLen);
+  }
+}
@@ -0,0 +1,37 @@
+/*
+ * Host stand-in for OctoWS2811: setPixel() writes a plain RGB frame and
+ * show() captures it, so native tools can inspect or dump every frame.
+ */
+
+#ifndef NATIVE_OCTOWS2811_H
+#define NATIVE_OCTOWS2811_H
+
+#include <stdint.h>
+
+#define WS2811_RGB      0
+#define WS2811_RBG      1
+#define WS2811_GRB      2
+#define WS2811_GBR      3
+#define WS2811_800kHz   0x00
+#define WS2811_400kHz   0x10
+
+class OctoWS2811 {
+public:
+  OctoWS2811(uint32_t numPerStrip, void *frameBuf, void *drawBuf, uint8_t config = WS2811_GRB);
+  void begin(void);
+  void setPixel(uint32_t num, int color);
+  int getPixel(uint32_t num);
+  void show(void);
+  int busy(void) { return 0; }
+  int numPixels(void) { return stripLen * 8; }
+
+  /* Called with the captured frame (numPixels() colors) after every show() */
+  static void (*showHook)(const int *frame, uint32_t numPerStrip);
+
+private:
+  uint32_t stripLen;
+  int *drawBuffer;
+  int *frameBuffer;
+};
+
+#endif // NATIVE_OCTOWS2811_H
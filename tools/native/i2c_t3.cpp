@@ -0,0 +1,76 @@
+#include "i2c_t3.h"
+
+i2c_t3 Wire;
+i2c_t3 Wire1;
+
+void i2c_t3::begin(int mode, uint8_t address, int pins, int pullup, unsigned long rate) {
+  (void)mode;
+  (void)address;
+  (void)pins;
+  (void)pullup;
+  clock = rate;
+}
+
+void i2c_t3::attachDevice(uint8_t address, i2c_t3_device *device) {
+  if (numDevices < I2C_MAX_DEVICES) {
+    devices[numDevices].address = address;
+    devices[numDevices].device = device;
+    numDevices++;
+  }
+}
+
+i2c_t3_device *i2c_t3::findDevice(uint8_t address) {
+  for (uint8_t i = 0; i < numDevices; i++) {
+    if (devices[i].address == address) {
+      return devices[i].device;
+    }
+  }
+  return 0;
+}
+
+void i2c_t3::beginTransmission(uint8_t address) {
+  txAddress = address;
+  txLength = 0;
+}
+
+size_t i2c_t3::write(uint8_t data) {
+  if (txLength >= I2C_TX_BUFFER_LENGTH) {
+    return 0;
+  }
+  txBuffer[txLength++] = data;
+  return 1;
+}
+
+// Same codes as the Wire library: 2 address NACK, 3 data NACK
+uint8_t i2c_t3::endTransmission(i2c_stop stop) {
+  (void)stop;
+  i2c_t3_device *device = findDevice(txAddress);
+  byteCount += 1 + txLength;
+  if (device == 0) {
+    return 2;
+  }
+  return device->receive(txBuffer, txLength) ? 0 : 3;
+}
+
+size_t i2c_t3::requestFrom(uint8_t address, size_t length, i2c_stop stop) {
+  sendRequest(address, length, stop);
+  return rxLength;
+}
+
+void i2c_t3::sendRequest(uint8_t address, size_t length, i2c_stop stop) {
+  (void)stop;
+  i2c_t3_device *device = findDevice(address);
+  if (length > I2C_RX_BUFFER_LENGTH) {
+    length = I2C_RX_BUFFER_LENGTH;
+  }
+  rxIndex = 0;
+  rxLength = (device != 0) ? device->transmit(rxBuffer, length) : 0;
+  byteCount += 1 + rxLength;
+}
+
+int i2c_t3::read(void) {
+  if (rxIndex >= rxLength) {
+    return -1;
+  }
+  return rxBuffer[rxIndex++];
+}
@@ -0,0 +1,79 @@
+/*
+ * Host stand-in for the i2c_t3 library (master mode only)
+ *
+ * Transfers are handed to device models attached to a bus by address.
+ * Everything completes immediately, so sendRequest() behaves like
+ * requestFrom() and finish() has nothing to wait for.
+ */
+
+#ifndef NATIVE_I2C_T3_H
+#define NATIVE_I2C_T3_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define I2C_MASTER      0
+#define I2C_PINS_18_19  0
+#define I2C_PINS_22_23  1
+#define I2C_PULLUP_EXT  0
+#define I2C_PULLUP_INT  1
+
+#define I2C_TX_BUFFER_LENGTH 259
+#define I2C_RX_BUFFER_LENGTH 259
+#define I2C_MAX_DEVICES      8
+
+enum i2c_stop { I2C_NOSTOP, I2C_STOP };
+
+// A slave on the virtual bus
+class i2c_t3_device {
+public:
+  virtual ~i2c_t3_device() {}
+  // master write, false NACKs the transfer
+  virtual bool receive(const uint8_t *data, size_t length) = 0;
+  // master read, returns the number of bytes sent
+  virtual size_t transmit(uint8_t *data, size_t length) = 0;
+};
+
+class i2c_t3 {
+public:
+  void begin(int mode, uint8_t address, int pins, int pullup, unsigned long rate);
+  void setClock(unsigned long rate) { clock = rate; }
+  unsigned long getClock(void) { return clock; }
+
+  void beginTransmission(uint8_t address);
+  size_t write(uint8_t data);
+  uint8_t endTransmission(i2c_stop stop = I2C_STOP);
+  size_t requestFrom(uint8_t address, size_t length, i2c_stop stop = I2C_STOP);
+  void sendRequest(uint8_t address, size_t length, i2c_stop stop = I2C_STOP);
+  void finish(void) {}
+  uint8_t done(void) { return 1; }
+  int available(void) { return rxLength - rxIndex; }
+  int read(void);
+
+  /* Host side: attach a device model, counters of the traffic */
+  void attachDevice(uint8_t address, i2c_t3_device *device);
+  unsigned long bytesTransferred(void) { return byteCount; }
+
+private:
+  i2c_t3_device *findDevice(uint8_t address);
+
+  struct {
+    uint8_t address;
+    i2c_t3_device *device;
+  } devices[I2C_MAX_DEVICES];
+  uint8_t numDevices = 0;
+
+  unsigned long clock = 100000;
+  uint8_t txAddress = 0;
+  uint8_t txBuffer[I2C_TX_BUFFER_LENGTH];
+  size_t txLength = 0;
+  uint8_t rxBuffer[I2C_RX_BUFFER_LENGTH];
+  size_t rxLength = 0;
+  size_t rxIndex = 0;
+  unsigned long byteCount = 0;
+};
+
+extern i2c_t3 Wire;
+extern i2c_t3 Wire1;
+
+#endif // NATIVE_I2C_T3_H
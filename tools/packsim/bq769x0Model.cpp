@@ -0,0 +1,255 @@
+#include "bq769x0Model.h"
+
+#include <Arduino.h>
+#include <FastCRC.h>
+#include <string.h>
+
+#include "registers.h"
+
+#define MODEL_ADC_PERIOD_MS 250
+#define MODEL_TS_PERIOD_MS  2000
+#define MODEL_CC_PERIOD_MS  250
+
+static FastCRC8 modelCRC;
+
+Bq769x0Model::Bq769x0Model(PackModel &pack, uint8_t address, uint8_t alertPin, int shunt_mOhm)
+  : pack(pack), address(address), alertPin(alertPin), shunt_mOhm(shunt_mOhm)
+{
+  memset(regs, 0, sizeof(regs));
+  memset(protectionTrips, 0, sizeof(protectionTrips));
+  regs[OV_TRIP] = 0xAC;
+  regs[UV_TRIP] = 0x97;
+
+  // gain 365 + 15 uV/LSB, bits 4..3 in ADCGAIN1, bits 2..0 in ADCGAIN2
+  regs[ADCGAIN1] = ((MODEL_ADC_GAIN - 365) >> 3) << 2;
+  regs[ADCGAIN2] = ((MODEL_ADC_GAIN - 365) & 0x07) << 5;
+  regs[ADCOFFSET] = MODEL_ADC_OFFSET;
+}
+
+// SYS_STAT changing from all clear to a flag raises ALERT
+void Bq769x0Model::setStatus(uint8_t flags) {
+  bool rising = (regs[SYS_STAT] == 0);
+  for (uint8_t bit = 0; bit < 8; bit++) {
+    if ((flags & (1 << bit)) && !(regs[SYS_STAT] & (1 << bit))) {
+      protectionTrips[bit]++;
+    }
+  }
+  regs[SYS_STAT] |= flags;
+  if (rising && flags) {
+    nativeTriggerInterrupt(alertPin);
+  }
+}
+
+void Bq769x0Model::writeRegister(uint8_t reg, uint8_t value) {
+  switch (reg) {
+    case SYS_STAT:
+      regs[SYS_STAT] &= ~value;   // write 1 to clear
+      break;
+    case SYS_CTRL2:
+      // the FETs can only be switched on while their faults are cleared
+      if (regs[SYS_STAT] & STAT_OV) {
+        value &= ~0x01;
+      }
+      if (regs[SYS_STAT] & (STAT_UV | STAT_SCD | STAT_OCD)) {
+        value &= ~0x02;
+      }
+      regs[SYS_CTRL2] = value;
+      break;
+    default:
+      if (reg < sizeof(regs)) {
+        regs[reg] = value;
+      }
+      break;
+  }
+}
+
+// [register][data][crc] ([data][crc] ...), the first CRC includes the
+// slave and register address, the following ones only their data byte
+bool Bq769x0Model::receive(const uint8_t *data, size_t length) {
+  if (length == 0) {
+    return true;
+  }
+  pointer = data[0];
+  if (length == 1) {
+    return true;    // sets the pointer for a following read
+  }
+
+  uint8_t first[3] = {(uint8_t)(address << 1), data[0], data[1]};
+  if (length < 3 || modelCRC.smbus(first, 3) != data[2]) {
+    writesRejected++;
+    return true;
+  }
+  for (size_t i = 3; i + 1 < length; i += 2) {
+    if (modelCRC.smbus(&data[i], 1) != data[i + 1]) {
+      writesRejected++;
+      return true;
+    }
+  }
+
+  writeRegister(pointer, data[1]);
+  for (size_t i = 3; i + 1 < length; i += 2) {
+    writeRegister(pointer + (i - 1) / 2, data[i]);
+  }
+  return true;
+}
+
+// Each data byte is followed by its CRC, the first one includes the slave
+// address with the read bit
+size_t Bq769x0Model::transmit(uint8_t *data, size_t length) {
+  size_t count = 0;
+  uint8_t reg = pointer;
+
+  while (count < length) {
+    uint8_t value = (reg < sizeof(regs)) ? regs[reg] : 0;
+    data[count++] = value;
+    if (count >= length) {
+      break;
+    }
+    if (count == 1) {
+      uint8_t first[2] = {(uint8_t)((address << 1) | 1), value};
+      data[count++] = modelCRC.smbus(first, 2);
+    }
+    else {
+      data[count++] = modelCRC.smbus(&value, 1);
+    }
+    reg++;
+  }
+
+  // simple LCG, independent of the pack model's random numbers
+  if (corruptProbability > 0 && count > 0) {
+    randomState = randomState * 1103515245 + 12345;
+    if ((randomState >> 8) % 1000000 < corruptProbability * 1000000) {
+      data[(randomState >> 4) % count] ^= 0x10;
+      readsCorrupted++;
+    }
+  }
+  return count;
+}
+
+void Bq769x0Model::store16(uint8_t reg, int value) {
+  regs[reg] = (value >> 8) & 0xFF;
+  regs[reg + 1] = value & 0xFF;
+}
+
+void Bq769x0Model::convertVoltages() {
+  double sum = 0;
+  for (int i = 0; i < pack.numCells; i++) {
+    double mV = pack.cellVoltage(i);
+    long adc = (long)((mV - MODEL_ADC_OFFSET) * 1000 / MODEL_ADC_GAIN + 0.5);
+    adc = (adc < 0) ? 0 : (adc > 0x3FFF) ? 0x3FFF : adc;
+    store16(VC1_HI_BYTE + 2 * i, adc);
+    sum += mV;
+  }
+  long adc = (long)((sum - pack.numCells * MODEL_ADC_OFFSET) * 1000 / (4 * MODEL_ADC_GAIN) + 0.5);
+  store16(BAT_HI_BYTE, adc);
+}
+
+// SYS_CTRL1 TEMP_SEL set: 10k NTC with beta 3435 against a 10k pull-up to
+// 3.3 V, else the die temperature, 1.2 V at 25 °C and -4.2 mV/°C.
+// The die is taken to be at pack temperature. 382 uV/LSB.
+void Bq769x0Model::convertTemperatures() {
+  double vtsx;
+  if (regs[SYS_CTRL1] & 0x08) {
+    double kelvin = pack.temperature_degC + 273.15;
+    double rts = 10000.0 * exp(3435.0 * (1.0 / kelvin - 1.0 / 298.15));
+    vtsx = 3300.0 * rts / (10000.0 + rts);
+  }
+  else {
+    vtsx = 1200.0 - 4.2 * (pack.temperature_degC - 25);
+  }
+  int adc = (int)(vtsx / 0.382);
+  for (int i = 0; i < 3; i++) {
+    store16(TS1_HI_BYTE + 2 * i, adc & 0x3FFF);
+  }
+}
+
+void Bq769x0Model::checkProtections(unsigned long dt_ms) {
+  regPROTECT1_t protect1;
+  regPROTECT2_t protect2;
+  regPROTECT3_t protect3;
+  protect1.regByte = regs[PROTECT1];
+  protect2.regByte = regs[PROTECT2];
+  protect3.regByte = regs[PROTECT3];
+
+  // trip levels 10-OV_TRIP-1000 and 01-UV_TRIP-0000 of the 14 bit ADC value
+  double ovThreshold = ((1 << 13) | (regs[OV_TRIP] << 4) | 0x08) * MODEL_ADC_GAIN / 1000.0 + MODEL_ADC_OFFSET;
+  double uvThreshold = ((1 << 12) | (regs[UV_TRIP] << 4)) * MODEL_ADC_GAIN / 1000.0 + MODEL_ADC_OFFSET;
+  bool ov = false;
+  bool uv = false;
+  for (int i = 0; i < pack.numCells; i++) {
+    ov |= pack.cellVoltage(i) > ovThreshold;
+    uv |= pack.cellVoltage(i) < uvThreshold;
+  }
+
+  ovTimer = ov ? ovTimer + dt_ms : 0;
+  if (ovTimer >= OV_delay_setting[protect3.bits.OV_DELAY] * 1000UL) {
+    setStatus(STAT_OV);
+    regs[SYS_CTRL2] &= ~0x01;
+  }
+  uvTimer = uv ? uvTimer + dt_ms : 0;
+  if (uvTimer >= UV_delay_setting[protect3.bits.UV_DELAY] * 1000UL) {
+    setStatus(STAT_UV);
+    regs[SYS_CTRL2] &= ~0x02;
+  }
+
+  // thresholds of the tables are for RSNS = 1, halved otherwise
+  double senseDivider = protect1.bits.RSNS ? 1 : 2;
+  double dischargeSense_mV = -pack.current_mA * shunt_mOhm / 1000;
+  if (dischargeSense_mV > SCD_threshold_setting[protect1.bits.SCD_THRESH] / senseDivider) {
+    setStatus(STAT_SCD);    // delays are below one step
+    regs[SYS_CTRL2] &= ~0x02;
+  }
+  bool ocd = dischargeSense_mV > OCD_threshold_setting[protect2.bits.OCD_THRESH] / senseDivider;
+  ocdTimer = ocd ? ocdTimer + dt_ms : 0;
+  if (ocdTimer >= (unsigned long)OCD_delay_setting[protect2.bits.OCD_DELAY]) {
+    setStatus(STAT_OCD);
+    regs[SYS_CTRL2] &= ~0x02;
+  }
+}
+
+void Bq769x0Model::step(unsigned long dt_ms) {
+  // ADC_EN: cell and pack voltages every 250 ms
+  if (regs[SYS_CTRL1] & 0x10) {
+    adcTimer += dt_ms;
+    if (adcTimer >= MODEL_ADC_PERIOD_MS) {
+      adcTimer -= MODEL_ADC_PERIOD_MS;
+      convertVoltages();
+    }
+    tsTimer += dt_ms;
+    if (tsTimer >= MODEL_TS_PERIOD_MS) {
+      tsTimer -= MODEL_TS_PERIOD_MS;
+      convertTemperatures();
+    }
+    checkProtections(dt_ms);
+  }
+
+  // CC_EN: averaged current every 250 ms, 8.44 uV/LSB
+  if (regs[SYS_CTRL2] & 0x40) {
+    ccSum_mAms += pack.current_mA * dt_ms;
+    ccTimer += dt_ms;
+    if (ccTimer >= MODEL_CC_PERIOD_MS) {
+      double average_mA = ccSum_mAms / ccTimer;
+      store16(CC_HI_BYTE, (int16_t)(average_mA * shunt_mOhm * 100 / 844));
+      ccTimer = 0;
+      ccSum_mAms = 0;
+      setStatus(STAT_CC_READY);
+    }
+  }
+
+  unsigned int mask = balancingMask();
+  for (int i = 0; i < pack.numCells; i++) {
+    pack.cells[i].bleeding = (mask >> i) & 1;
+  }
+}
+
+bool Bq769x0Model::chargeEnabled() {
+  return regs[SYS_CTRL2] & 0x01;
+}
+
+bool Bq769x0Model::dischargeEnabled() {
+  return regs[SYS_CTRL2] & 0x02;
+}
+
+unsigned int Bq769x0Model::balancingMask() {
+  return (regs[CELLBAL1] & 0x1F) | ((regs[CELLBAL2] & 0x1F) << 5) | ((regs[CELLBAL3] & 0x1F) << 10);
+}
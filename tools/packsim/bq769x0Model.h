@@ -0,0 +1,66 @@
+/*
+ * Register level model of a bq769x0 (CRC variant) on the host i2c_t3 bus
+ *
+ * Implements what the driver uses: CRC-checked register reads and writes,
+ * cell, pack, thermistor and coulomb counter conversions from a PackModel,
+ * the hardware OV/UV/OCD/SCD protections with their delays, the CHG/DSG
+ * FETs, cell balancing switches and the ALERT pin. Optionally corrupts
+ * read data to exercise the driver's CRC checks and retries.
+ */
+
+#ifndef BQ769X0MODEL_H
+#define BQ769X0MODEL_H
+
+#include <i2c_t3.h>
+
+#include "packModel.h"
+
+#define MODEL_ADC_GAIN      380     // uV/LSB
+#define MODEL_ADC_OFFSET    20      // mV
+
+class Bq769x0Model : public i2c_t3_device {
+public:
+  Bq769x0Model(PackModel &pack, uint8_t address, uint8_t alertPin, int shunt_mOhm);
+
+  bool receive(const uint8_t *data, size_t length);
+  size_t transmit(uint8_t *data, size_t length);
+
+  // advances conversions and protections, updates the balancing switches
+  // of the pack
+  void step(unsigned long dt_ms);
+
+  bool chargeEnabled(void);
+  bool dischargeEnabled(void);
+  unsigned int balancingMask(void);
+
+  double corruptProbability = 0;      // per read transfer
+  unsigned long readsCorrupted = 0;
+  unsigned long writesRejected = 0;   // wrong CRC, ignored like the IC does
+  unsigned long protectionTrips[8];   // per SYS_STAT bit
+
+private:
+  void setStatus(uint8_t flags);
+  void writeRegister(uint8_t reg, uint8_t value);
+  void convertVoltages(void);
+  void convertTemperatures(void);
+  void checkProtections(unsigned long dt_ms);
+  void store16(uint8_t reg, int value);
+
+  PackModel &pack;
+  uint8_t address;
+  uint8_t alertPin;
+  int shunt_mOhm;
+  uint8_t regs[0x60];
+  uint8_t pointer = 0;
+  unsigned int randomState = 1;
+
+  unsigned long adcTimer = 0;
+  unsigned long tsTimer = 0;
+  unsigned long ccTimer = 0;
+  double ccSum_mAms = 0;
+  unsigned long ovTimer = 0;
+  unsigned long uvTimer = 0;
+  unsigned long ocdTimer = 0;
+};
+
+#endif // BQ769X0MODEL_H
@@ -0,0 +1,342 @@
+/*
+ * packsim - runs the bq769x0 driver against a simulated pack, faster than
+ * real time
+ *
+ * A PackModel (cells with OCV curve, internal resistance, self discharge and
+ * balancing bleed) sits behind a register model of the bq769x0 on the
+ * host i2c_t3 bus. The driver runs unchanged through bq769x0Poller, with
+ * checkStatus() after every update, on the virtual millis() clock. A load
+ * profile of charge, discharge and rest phases drives the pack.
+ *
+ * Profile file, one phase per line: <charge|discharge|rest> <mA> <seconds>
+ * Charge phases are CC/CV to 4.2 V per cell and end below CHARGE_CUTOFF_MA.
+ * The built-in profile takes the default pack from 67.7 mV to 23.2 mV OCV
+ * spread: balancing stops once the measured spread is within the 20 mV
+ * balancingMaxDifference of the default config.
+ *
+ * tools/packsim/overload.profile holds a 12 A discharge past the default
+ * OCD limit for 20 minutes. The first OCD clear attempt comes 60 s after
+ * the trip, the following ones 120, 240 and 480 s apart (the backoff).
+ *
+ * The TS inputs read the die temperature like on the board, -x fits
+ * thermistors instead. -T sets the pack (and die) temperature.
+ *
+ * -t writes every I2C transaction of the driver as a capture in the format
+ * of traceSend(), for tools/i2creplay.
+ *
+ * Build and run: pio run -e packsim && .pio/build/packsim/program -o run.csv
+ */
+
+#include <Arduino.h>
+#include <i2c_t3.h>
+
+#include <chrono>
+#include <stdio.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "bq769x0CRC.h"
+#include "bq769x0Poller.h"
+#include "bmsConfig.h"
+#include "i2cTrace.h"
+#include "logRing.h"
+
+#include "bq769x0Model.h"
+#include "packModel.h"
+
+#define SIM_TICK_MS         10
+#define SIM_ALERT_PIN       16
+#define SIM_I2C_ADDRESS     0x18
+#define SIM_MAX_PHASES      32
+#define CHARGE_CUTOFF_MA    50
+#define CHARGE_CELL_MV      4200
+#define FET_RETRY_MS        5000      // host retries enabling a FET this often
+#define SIM_MAX_CLEARS      32        // OCD clear attempts reported
+
+enum phase_kind { PHASE_REST, PHASE_CHARGE, PHASE_DISCHARGE };
+
+typedef struct {
+  phase_kind    kind;
+  double        current_mA;
+  unsigned long duration_s;
+} sim_phase;
+
+static const char *phaseNames[] = { "rest", "charge", "discharge" };
+
+// charge a half charged, unbalanced pack, let it balance, then use it
+static sim_phase phases[SIM_MAX_PHASES] = {
+  { PHASE_CHARGE, 1500, 3 * 3600 },
+  { PHASE_REST, 0, 2 * 3600 },
+  { PHASE_DISCHARGE, 2000, 3600 },
+  { PHASE_REST, 0, 600 },
+};
+static int numPhases = 4;
+
+static bool verbose = false;
+static unsigned long eventCounts[256];
+static unsigned long ocdClears[SIM_MAX_CLEARS];   // millis() of the clear attempts
+static int numOcdClears = 0;
+static FILE *traceFile = NULL;
+
+static void writeTrace(const uint8_t *buffer, size_t size) {
+  fwrite(buffer, 1, size, traceFile);
+}
+
+// The firmware's event log, printed instead of sent
+void logEvent(uint8_t event, int16_t arg0, int16_t arg1) {
+  eventCounts[event]++;
+  if (event == LOG_BMS_OCD_CLEAR && numOcdClears < SIM_MAX_CLEARS) {
+    ocdClears[numOcdClears++] = millis();
+  }
+  if (verbose) {
+    fprintf(stderr, "%10.3f event %3u %6d %6d\n", millis() / 1000.0, event, arg0, arg1);
+  }
+}
+
+static bool loadProfile(const char *path) {
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    perror(path);
+    return false;
+  }
+  char line[128];
+  numPhases = 0;
+  while (fgets(line, sizeof(line), file) != NULL && numPhases < SIM_MAX_PHASES) {
+    char kind[16];
+    double current;
+    unsigned long duration;
+    if (line[0] == '#' || sscanf(line, "%15s %lf %lu", kind, &current, &duration) != 3) {
+      continue;
+    }
+    sim_phase *phase = &phases[numPhases];
+    phase->current_mA = current;
+    phase->duration_s = duration;
+    if (strcmp(kind, "charge") == 0) {
+      phase->kind = PHASE_CHARGE;
+    }
+    else if (strcmp(kind, "discharge") == 0) {
+      phase->kind = PHASE_DISCHARGE;
+    }
+    else {
+      phase->kind = PHASE_REST;
+    }
+    numPhases++;
+  }
+  fclose(file);
+  return numPhases > 0;
+}
+
+// CC/CV charger: constant current until the pack reaches the charge
+// voltage, then the current the remaining headroom allows
+static double chargerCurrent(PackModel &pack, double setpoint_mA) {
+  double headroom_mV = pack.numCells * CHARGE_CELL_MV - pack.packOCV();
+  double current = headroom_mV * 1000 / pack.packResistance();
+  if (current > setpoint_mA) {
+    return setpoint_mA;
+  }
+  return (current < CHARGE_CUTOFF_MA) ? 0 : current;
+}
+
+int main(int argc, char **argv) {
+  int numCells = 10;
+  double capacity_mAh = 3000;
+  double soc = 0.5;
+  double socSpread = 0.1;
+  unsigned seed = 1;
+  double corruptProbability = 0;
+  unsigned long csvInterval_s = 60;
+  double temperature_degC = 25;
+  bool thermistors = false;
+  FILE *csv = NULL;
+  int opt;
+
+  while ((opt = getopt(argc, argv, "n:c:s:u:r:e:p:o:i:t:T:xv")) != -1) {
+    switch (opt) {
+      case 'n': numCells = atoi(optarg); break;
+      case 'c': capacity_mAh = atof(optarg); break;
+      case 's': soc = atof(optarg) / 100; break;
+      case 'u': socSpread = atof(optarg) / 100; break;
+      case 'r': seed = strtoul(optarg, NULL, 0); break;
+      case 'e': corruptProbability = atof(optarg); break;
+      case 'i': csvInterval_s = strtoul(optarg, NULL, 0); break;
+      case 'T': temperature_degC = atof(optarg); break;
+      case 'x': thermistors = true; break;
+      case 'v': verbose = true; break;
+      case 'p':
+        if (!loadProfile(optarg)) {
+          return 1;
+        }
+        break;
+      case 'o':
+        csv = fopen(optarg, "w");
+        if (csv == NULL) {
+          perror(optarg);
+          return 1;
+        }
+        break;
+      case 't':
+        traceFile = fopen(optarg, "wb");
+        if (traceFile == NULL) {
+          perror(optarg);
+          return 1;
+        }
+        traceStart();
+        break;
+      default:
+        fprintf(stderr, "usage: %s [-n cells] [-c capacity mAh] [-s soc %%] [-u soc spread %%]\n"
+          "  [-r seed] [-e read corruption probability] [-p profile] [-o out.csv] [-i csv interval s]\n"
+          "  [-t capture.bin] [-T temperature °C] [-x] [-v]\n",
+          argv[0]);
+        return 1;
+    }
+  }
+  if (numCells < 3 || numCells > SIM_MAX_CELLS || csvInterval_s == 0) {
+    fprintf(stderr, "3 to %d cells, csv interval > 0\n", SIM_MAX_CELLS);
+    return 1;
+  }
+
+  bq769x0_config config = configLoad();   // EEPROM stand-in is erased: defaults
+  PackModel pack(numCells, capacity_mAh, soc, socSpread, seed);
+  pack.temperature_degC = temperature_degC;
+  Bq769x0Model model(pack, SIM_I2C_ADDRESS, SIM_ALERT_PIN, config.shuntResistor_mOhm);
+  model.corruptProbability = corruptProbability;
+  Wire.attachDevice(SIM_I2C_ADDRESS, &model);
+
+  byte type = (numCells <= 5) ? bq76920 : (numCells <= 10) ? bq76930 : bq76940;
+  bq769x0 BMS(numCells, type, SIM_I2C_ADDRESS);
+  bq769x0Poller poller;
+  BMS.setThermistors(thermistors);
+  if (BMS.begin(&Wire, SIM_ALERT_PIN, -1) != 0) {
+    fprintf(stderr, "BMS.begin() failed\n");
+    return 1;
+  }
+  int result = BMS.applyConfig(config);
+  if (result != CONFIG_OK) {
+    fprintf(stderr, "applyConfig() failed: %d\n", result);
+    return 1;
+  }
+  BMS.enableAutoBalancing();
+  BMS.setWarningBand(WARN_CELL_LOW, 3300, 50);
+  BMS.setWarningBand(WARN_CELL_HIGH, 4150, 30);
+  BMS.setWarningBand(WARN_CHARGE_CURRENT, 1400, 200);
+  BMS.setWarningBand(WARN_TEMP_LOW, 50, 20);     // the firmware's bands
+  BMS.setWarningBand(WARN_TEMP_HIGH, 400, 20);
+  poller.addPack(&BMS);
+
+  if (csv != NULL) {
+    fprintf(csv, "time_s,phase,current_mA,bms_current_mA,bms_pack_mV,bms_min_mV,bms_max_mV,"
+      "ocv_spread_mV,balancing,status\n");
+  }
+
+  double startSpread = pack.ocvSpread();
+  unsigned long updates = 0;
+  unsigned long warningChanges = 0;
+  unsigned long lastFetAttempt = 0;
+  unsigned long nextCsv = 0;
+  std::chrono::steady_clock::time_point wallStart = std::chrono::steady_clock::now();
+
+  for (int p = 0; p < numPhases; p++) {
+    sim_phase *phase = &phases[p];
+    unsigned long phaseEnd = millis() + phase->duration_s * 1000;
+    bool chargerDone = false;
+
+    while (millis() < phaseEnd) {
+      // host side of the pack: charger and load behind the FETs
+      double current = 0;
+      if (phase->kind == PHASE_CHARGE && !chargerDone && model.chargeEnabled()) {
+        current = chargerCurrent(pack, phase->current_mA);
+        chargerDone = (current == 0);
+      }
+      else if (phase->kind == PHASE_DISCHARGE && model.dischargeEnabled()) {
+        current = -phase->current_mA;
+      }
+
+      pack.step(SIM_TICK_MS, current);
+      model.step(SIM_TICK_MS);
+      nativeAdvanceMillis(SIM_TICK_MS);
+
+      if (poller.tick()) {
+        updates++;
+        BMS.checkStatus();
+
+        byte changes = BMS.getWarningChanges();
+        if (changes != 0) {
+          warningChanges++;
+          if (verbose) {
+            fprintf(stderr, "%10.3f warnings 0x%02x changed 0x%02x\n", millis() / 1000.0,
+              BMS.getWarningStatus(), changes);
+          }
+        }
+
+        // the application asks for the FETs it needs, the driver decides
+        if (millis() - lastFetAttempt >= FET_RETRY_MS) {
+          if (!model.chargeEnabled()) {
+            BMS.enableCharging();
+            lastFetAttempt = millis();
+          }
+          if (!model.dischargeEnabled()) {
+            BMS.enableDischarging();
+            lastFetAttempt = millis();
+          }
+        }
+      }
+
+      // the ring holds more than one pass, empty it every tick
+      if (traceFile != NULL) {
+        traceSend(writeTrace);
+        traceStart();
+      }
+
+      if (csv != NULL && millis() >= nextCsv) {
+        nextCsv += csvInterval_s * 1000;
+        fprintf(csv, "%lu,%s,%.0f,%d,%d,%d,%d,%.1f,0x%04x,0x%04x\n",
+          millis() / 1000, phaseNames[phase->kind], current, BMS.getBatteryCurrent(),
+          BMS.getBatteryVoltage(), BMS.getMinCellVoltage(), BMS.getMaxCellVoltage(),
+          pack.ocvSpread(), BMS.getBalancingStatus(), BMS.getErrorStatus());
+      }
+    }
+  }
+
+  double wall_s = std::chrono::duration<double>(std::chrono::steady_clock::now() - wallStart).count();
+  double sim_s = millis() / 1000.0;
+  i2c_link_stats link = BMS.getLinkStats();
+
+  printf("simulated %.2f h in %.2f s (%.0fx real time), %lu BMS updates\n",
+    sim_s / 3600, wall_s, wall_s > 0 ? sim_s / wall_s : 0, updates);
+  printf("cell OCV spread %.1f mV -> %.1f mV\n", startSpread, pack.ocvSpread());
+  printf("%-5s %8s %8s %10s\n", "cell", "soc %", "ocv mV", "bleed s");
+  for (int i = 0; i < numCells; i++) {
+    printf("%-5d %8.1f %8.0f %10.0f\n", i + 1, pack.cellSOC(i) * 100, pack.cellOCV(i),
+      pack.cells[i].bleedTime_s);
+  }
+  printf("protection trips: OCD %lu, SCD %lu, OV %lu, UV %lu\n", model.protectionTrips[0],
+    model.protectionTrips[1], model.protectionTrips[2], model.protectionTrips[3]);
+  if (numOcdClears > 0) {
+    printf("OCD clear attempts %d, s apart:", numOcdClears);
+    for (int i = 1; i < numOcdClears; i++) {
+      printf(" %.1f", (ocdClears[i] - ocdClears[i - 1]) / 1000.0);
+    }
+    printf("\n");
+  }
+  printf("i2c: %lu transfers, %lu crc errors, %lu bus errors, %lu failed, %lu corrupted, "
+    "%lu writes rejected, clock %lu Hz\n", link.transfers, link.crcErrors, link.busErrors,
+    link.failures, model.readsCorrupted, model.writesRejected, link.clock);
+  printf("temperature %.1f °C, read %.1f °C from the %s\n", pack.temperature_degC,
+    BMS.getTemperatureDegC(1), thermistors ? "thermistors" : "die");
+  printf("warning changes: %lu\n", warningChanges);
+  printf("log events:");
+  for (int i = 0; i < 256; i++) {
+    if (eventCounts[i] != 0) {
+      printf(" %d:%lu", i, eventCounts[i]);
+    }
+  }
+  printf("\n");
+
+  if (csv != NULL) {
+    fclose(csv);
+  }
+  if (traceFile != NULL) {
+    fclose(traceFile);
+  }
+  return 0;
+}
@@ -0,0 +1,3 @@
+# sustained overload past the default OCD limit: the driver retries the
+# clear with a growing delay, run with -p tools/packsim/overload.profile
+discharge 12000 1200
@@ -0,0 +1,102 @@
+#include "packModel.h"
+
+#include <random>
+
+// NMC open circuit voltage at 0, 10, ..., 100 % state of charge (mV)
+static const double ocvCurve[11] = {
+  3000, 3450, 3550, 3620, 3680, 3750, 3830, 3920, 4000, 4090, 4200
+};
+
+PackModel::PackModel(int numCells, double capacity_mAh, double soc, double socSpread, unsigned seed)
+  : numCells(numCells)
+{
+  std::mt19937 rng(seed);
+  std::normal_distribution<double> capacityVariation(1.0, 0.02);
+  std::normal_distribution<double> resistanceVariation(1.0, 0.1);
+  std::uniform_real_distribution<double> socVariation(-socSpread / 2, socSpread / 2);
+  std::uniform_real_distribution<double> selfDischarge(0.01, 0.05);
+
+  for (int i = 0; i < numCells; i++) {
+    sim_cell *cell = &cells[i];
+    cell->capacity_mAs = capacity_mAh * 3600 * capacityVariation(rng);
+    double cellSoc = soc + socVariation(rng);
+    cellSoc = (cellSoc < 0) ? 0 : (cellSoc > 1) ? 1 : cellSoc;
+    cell->charge_mAs = cellSoc * cell->capacity_mAs;
+    cell->resistance_mOhm = 30 * resistanceVariation(rng);
+    cell->selfDischarge_mA = selfDischarge(rng);
+    cell->bleeding = false;
+    cell->bleedTime_s = 0;
+  }
+}
+
+double PackModel::ocv(double soc) {
+  if (soc <= 0) {
+    return ocvCurve[0];
+  }
+  if (soc >= 1) {
+    return ocvCurve[10];
+  }
+  int i = (int)(soc * 10);
+  double fraction = soc * 10 - i;
+  return ocvCurve[i] + (ocvCurve[i + 1] - ocvCurve[i]) * fraction;
+}
+
+void PackModel::step(unsigned long dt_ms, double current) {
+  double dt_s = dt_ms / 1000.0;
+  current_mA = current;
+
+  for (int i = 0; i < numCells; i++) {
+    sim_cell *cell = &cells[i];
+    double cellCurrent = current - cell->selfDischarge_mA;
+    if (cell->bleeding) {
+      cellCurrent -= cellOCV(i) / bleedResistance_Ohm;   // mV / Ohm = mA
+      cell->bleedTime_s += dt_s;
+    }
+    cell->charge_mAs += cellCurrent * dt_s;
+    if (cell->charge_mAs < 0) {
+      cell->charge_mAs = 0;
+    }
+    if (cell->charge_mAs > cell->capacity_mAs) {
+      cell->charge_mAs = cell->capacity_mAs;
+    }
+  }
+}
+
+double PackModel::cellSOC(int cell) {
+  return cells[cell].charge_mAs / cells[cell].capacity_mAs;
+}
+
+double PackModel::cellOCV(int cell) {
+  return ocv(cellSOC(cell));
+}
+
+double PackModel::cellVoltage(int cell) {
+  return cellOCV(cell) + current_mA * cells[cell].resistance_mOhm / 1000;
+}
+
+double PackModel::packOCV() {
+  double sum = 0;
+  for (int i = 0; i < numCells; i++) {
+    sum += cellOCV(i);
+  }
+  return sum;
+}
+
+double PackModel::packResistance() {
+  double sum = 0;
+  for (int i = 0; i < numCells; i++) {
+    sum += cells[i].resistance_mOhm;
+  }
+  return sum;
+}
+
+double PackModel::ocvSpread() {
+  double lowest = cellOCV(0);
+  double highest = lowest;
+  for (int i = 1; i < numCells; i++) {
+    double v = cellOCV(i);
+    lowest = (v < lowest) ? v : lowest;
+    highest = (v > highest) ? v : highest;
+  }
+  return highest - lowest;
+}
@@ -0,0 +1,51 @@
+/*
+ * Electrical model of a series string of Li-ion cells
+ *
+ * Every cell has its own capacity, charge, internal resistance and self
+ * discharge. The terminal voltage is the open circuit voltage from an NMC
+ * OCV curve plus the drop over the internal resistance. A cell with its
+ * balancing switch closed is discharged through the bleed resistor.
+ */
+
+#ifndef PACKMODEL_H
+#define PACKMODEL_H
+
+#include <stdint.h>
+
+#define SIM_MAX_CELLS 15
+
+typedef struct {
+  double capacity_mAs;
+  double charge_mAs;
+  double resistance_mOhm;
+  double selfDischarge_mA;
+  bool   bleeding;
+  double bleedTime_s;           // total time with the balancing switch closed
+} sim_cell;
+
+class PackModel {
+public:
+  // capacities, resistances and initial charges vary randomly around the
+  // nominal values, socSpread is the full range of the initial charge (0..1)
+  PackModel(int numCells, double capacity_mAh, double soc, double socSpread, unsigned seed);
+
+  // current_mA > 0 charges the pack
+  void step(unsigned long dt_ms, double current_mA);
+
+  double cellVoltage(int cell);   // mV at the terminals, with the last current
+  double cellOCV(int cell);       // mV
+  double cellSOC(int cell);       // 0..1
+  double packOCV(void);           // mV
+  double packResistance(void);    // mOhm
+  double ocvSpread(void);         // mV, highest minus lowest cell OCV
+
+  static double ocv(double soc);  // mV
+
+  int numCells;
+  sim_cell cells[SIM_MAX_CELLS];
+  double current_mA = 0;
+  double temperature_degC = 25;
+  double bleedResistance_Ohm = 68;
+};
+
+#endif // PACKMODEL_H